@@ -0,0 +1,355 @@
+/*****************************************************************************
+
+NAME:
+   bloom.c -- Bloom filter of a wordlist's tokens, a negative cache for
+		ds_read().
+
+   Most tokens of a message are not in the wordlist, and each of them
+   costs a B-tree descent.  "bogoutil --build-filter" writes a Bloom
+   filter of the wordlist's tokens next to it, as "<wordlist>.bloom";
+   with negative_cache set, ds_read() asks the filter first and does
+   not search the wordlist for a token the filter has never seen.
+
+   The filter must hold every token of the wordlist, or ds_read() would
+   miss counts.  Processes that write the wordlist therefore map the
+   filter, if there is one, and add each token that ds_write() stores.
+   Deleted tokens stay in the filter until it is rebuilt, which only
+   costs lookups.  The file holds a header:
+	"BFBLOOM1", log2 of the number of bits, hash count, token count
+   (big-endian 32-bit numbers; the count is the one at the build) and
+   then the bits, 2^n of them.
+
+   Rebuilding replaces the file, and processes notice that at the start
+   of their next transaction.  Tokens that other processes write while
+   the filter is being built may be missing from it, so build it while
+   nothing else writes to the wordlist, as with "bogoutil -m".
+
+******************************************************************************/
+
+#include "common.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef	HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
+#include "bloom.h"
+#include "datastore.h"
+#include "mxcat.h"
+#include "xmalloc.h"
+
+#define	BLOOM_SUFFIX	".bloom"
+#define	BLOOM_MAGIC	"BFBLOOM1"
+#define	MAGIC_SIZE	8
+#define	HEADER_SIZE	(MAGIC_SIZE + 4 + 4 + 4)
+
+#define	BITS_PER_TOKEN	10	/* about 1% false positives with ... */
+#define	HASHES		7	/* ... this many hashes */
+#define	MIN_LOG2_BITS	16
+#define	MAX_LOG2_BITS	32
+
+struct bloom_s {
+    byte      *map;		/* the whole file */
+    size_t     size;
+    byte      *bits;
+    u_int64_t  mask;		/* number of bits - 1 */
+    uint       hashes;
+    bool       writable;
+    dev_t      dev;		/* to notice a rebuild */
+    ino_t      ino;
+};
+
+static char *bloom_path(const bfpath *bfp)
+{
+    return mxcat(bfp->filepath, BLOOM_SUFFIX, NULL);
+}
+
+static void put_u32(byte *p, u_int32_t v)
+{
+    p[0] = (byte)(v >> 24);
+    p[1] = (byte)(v >> 16);
+    p[2] = (byte)(v >> 8);
+    p[3] = (byte)v;
+}
+
+static u_int32_t get_u32(const byte *p)
+{
+    return ((u_int32_t)p[0] << 24) | ((u_int32_t)p[1] << 16) |
+	((u_int32_t)p[2] << 8) | (u_int32_t)p[3];
+}
+
+/* FNV-1a, with the final mix of MurmurHash3 so that both halves of the
+ * result can serve as hashes */
+static u_int64_t token_hash(const word_t *token)
+{
+    u_int64_t h = 0xcbf29ce484222325ULL;
+    uint i;
+
+    for (i = 0; i < token->leng; i += 1) {
+	h ^= token->u.text[i];
+	h *= 0x100000001b3ULL;
+    }
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+/* the i-th bit of a token, by double hashing */
+#define	BIT_OF(h, i, mask)	((((h) & 0xffffffffULL) + (i) * (((h) >> 32) | 1)) & (mask))
+
+static void set_bits(byte *bits, u_int64_t mask, uint hashes, u_int64_t h)
+{
+    uint i;
+
+    for (i = 0; i < hashes; i += 1) {
+	u_int64_t b = BIT_OF(h, i, mask);
+	byte m = (byte)(1 << (b & 7));
+	if ((bits[b >> 3] & m) == 0) {
+#ifdef	__GNUC__
+	    /* the pages are shared with other writers */
+	    (void) __sync_fetch_and_or(&bits[b >> 3], m);
+#else
+	    bits[b >> 3] |= m;
+#endif
+	}
+    }
+}
+
+bloom_t *bloom_open(const bfpath *bfp, bool writable)
+{
+#ifdef	HAVE_MMAP
+    bloom_t *bloom = NULL;
+    char *path = bloom_path(bfp);
+    struct stat st;
+    byte head[HEADER_SIZE];
+    u_int32_t log2_bits, hashes;
+    int fd;
+
+    fd = open(path, writable ? O_RDWR : O_RDONLY);
+    xfree(path);
+    if (fd < 0)
+	return NULL;
+
+    if (fstat(fd, &st) != 0 ||
+	read(fd, head, sizeof(head)) != (ssize_t) sizeof(head) ||
+	memcmp(head, BLOOM_MAGIC, MAGIC_SIZE) != 0)
+	goto invalid;
+
+    log2_bits = get_u32(head + MAGIC_SIZE);
+    hashes = get_u32(head + MAGIC_SIZE + 4);
+    if (log2_bits < 3 || log2_bits > MAX_LOG2_BITS || hashes == 0 ||
+	(u_int64_t) st.st_size != HEADER_SIZE + ((u_int64_t) 1 << (log2_bits - 3)))
+	goto invalid;
+
+    bloom = (bloom_t *)xcalloc(1, sizeof(*bloom));
+    bloom->size = (size_t) st.st_size;
+    bloom->map = (byte *)mmap(NULL, bloom->size,
+			      writable ? (PROT_READ | PROT_WRITE) : PROT_READ,
+			      MAP_SHARED, fd, 0);
+    if (bloom->map == (byte *)MAP_FAILED) {
+	xfree(bloom);
+	bloom = NULL;
+    } else {
+	bloom->bits = bloom->map + HEADER_SIZE;
+	bloom->mask = ((u_int64_t) 1 << log2_bits) - 1;
+	bloom->hashes = hashes;
+	bloom->writable = writable;
+	bloom->dev = st.st_dev;
+	bloom->ino = st.st_ino;
+    }
+    close(fd);
+    return bloom;
+
+invalid:
+    close(fd);
+    fprintf(stderr, "Invalid filter for '%s', not used.\n", bfp->filepath);
+    return NULL;
+#else
+    (void) bfp;
+    (void) writable;
+    return NULL;
+#endif
+}
+
+void bloom_close(bloom_t *bloom)
+{
+    if (bloom == NULL)
+	return;
+#ifdef	HAVE_MMAP
+    (void) munmap((void *)bloom->map, bloom->size);
+#endif
+    xfree(bloom);
+}
+
+bloom_t *bloom_check(bloom_t *bloom, const bfpath *bfp, bool writable)
+{
+    char *path = bloom_path(bfp);
+    struct stat st;
+    int e = stat(path, &st);
+
+    xfree(path);
+
+    if (e != 0) {
+	bloom_close(bloom);
+	return NULL;
+    }
+    if (bloom != NULL && bloom->dev == st.st_dev && bloom->ino == st.st_ino)
+	return bloom;
+
+    bloom_close(bloom);
+    return bloom_open(bfp, writable);
+}
+
+bool bloom_maybe(const bloom_t *bloom, const word_t *token)
+{
+    u_int64_t h = token_hash(token);
+    uint i;
+
+    for (i = 0; i < bloom->hashes; i += 1) {
+	u_int64_t b = BIT_OF(h, i, bloom->mask);
+	if ((bloom->bits[b >> 3] & (1 << (b & 7))) == 0)
+	    return false;
+    }
+
+    return true;
+}
+
+void bloom_add(bloom_t *bloom, const word_t *token)
+{
+    if (bloom->writable)
+	set_bits(bloom->bits, bloom->mask, bloom->hashes, token_hash(token));
+}
+
+/* bogoutil --build-filter */
+
+typedef struct {
+    u_int64_t *hash;
+    size_t     count;
+    size_t     alloc;
+} hashes_t;
+
+static ex_t collect_hook(word_t *token, dsv_t *data, void *userdata)
+{
+    hashes_t *hs = (hashes_t *)userdata;
+
+    (void) data;
+
+    if (hs->count == hs->alloc) {
+	hs->alloc = hs->alloc ? 2 * hs->alloc : 4096;
+	hs->hash = (u_int64_t *)xrealloc(hs->hash, hs->alloc * sizeof(hs->hash[0]));
+    }
+    hs->hash[hs->count++] = token_hash(token);
+
+    return EX_OK;
+}
+
+/* write the filter of the tokens of \a hs to a new file, and put it in
+ * place of the old one */
+static ex_t write_filter(const bfpath *bfp, const hashes_t *hs)
+{
+    char *path = bloom_path(bfp);
+    char *temp = mxcat(path, ".tmp", NULL);
+    u_int32_t log2_bits = MIN_LOG2_BITS;
+    u_int64_t nbits;
+    size_t i, size;
+    byte *buf;
+    ex_t rc = EX_OK;
+    FILE *fp;
+
+    while (log2_bits < MAX_LOG2_BITS &&
+	   ((u_int64_t) 1 << log2_bits) < (u_int64_t) hs->count * BITS_PER_TOKEN)
+	log2_bits += 1;
+    nbits = (u_int64_t) 1 << log2_bits;
+
+    size = HEADER_SIZE + (size_t)(nbits >> 3);
+    buf = (byte *)xcalloc(1, size);
+    memcpy(buf, BLOOM_MAGIC, MAGIC_SIZE);
+    put_u32(buf + MAGIC_SIZE, log2_bits);
+    put_u32(buf + MAGIC_SIZE + 4, HASHES);
+    put_u32(buf + MAGIC_SIZE + 8, (u_int32_t) hs->count);
+
+    for (i = 0; i < hs->count; i += 1)
+	set_bits(buf + HEADER_SIZE, nbits - 1, HASHES, hs->hash[i]);
+
+    fp = fopen(temp, "wb");
+    if (fp == NULL ||
+	fwrite(buf, 1, size, fp) != size ||
+	fflush(fp) != 0 || fsync(fileno(fp)) != 0) {
+	fprintf(stderr, "Cannot write '%s': %s\n", temp, strerror(errno));
+	rc = EX_ERROR;
+    }
+    if (fp != NULL && fclose(fp) != 0 && rc == EX_OK) {
+	fprintf(stderr, "Cannot write '%s': %s\n", temp, strerror(errno));
+	rc = EX_ERROR;
+    }
+    if (rc == EX_OK && rename(temp, path) != 0) {
+	fprintf(stderr, "Cannot rename '%s' to '%s': %s\n", temp, path, strerror(errno));
+	rc = EX_ERROR;
+    }
+    if (rc != EX_OK)
+	(void) unlink(temp);
+
+    if (rc == EX_OK && verbose) {
+	double fill = -(double) HASHES * hs->count / (double) nbits;
+	fprintf(dbgout, "Filter of '%s': %lu tokens, %lu KiB, %d hashes, "
+		"expected false positive rate %.2f%%\n",
+		bfp->filepath, (unsigned long) hs->count,
+		(unsigned long) (nbits >> 13), HASHES,
+		100.0 * pow(1.0 - exp(fill), HASHES));
+    }
+
+    xfree(buf);
+    xfree(temp);
+    xfree(path);
+
+    return rc;
+}
+
+ex_t build_filter_file(bfpath *bfp)
+{
+    ex_t rc;
+    void *dbe;
+    void *dsh;
+    hashes_t hs;
+
+    memset(&hs, 0, sizeof(hs));
+
+    dbe = ds_init(bfp);
+
+    /* opened for writing, so that backends that lock whole files keep
+     * writers out until the new filter is in place */
+    dsh = ds_open(dbe, bfp, DS_WRITE);
+    if (dsh == NULL)
+	return EX_ERROR;
+
+    if (ds_txn_begin(dsh) != DST_OK) {
+	ds_close(dsh);
+	ds_cleanup(dbe);
+	return EX_ERROR;
+    }
+
+    rc = ds_foreach(dsh, collect_hook, &hs);
+    if (rc == EX_OK)
+	rc = write_filter(bfp, &hs);
+
+    if (ds_txn_commit(dsh) != DST_OK)
+	rc = EX_ERROR;
+
+    xfree(hs.hash);
+
+    ds_close(dsh);
+    ds_cleanup(dbe);
+
+    return rc;
+}
@@ -0,0 +1,38 @@
+/*****************************************************************************
+
+NAME:
+   bloom.h -- Bloom filter of a wordlist's tokens, a negative cache for
+		ds_read().
+
+******************************************************************************/
+
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include "paths.h"
+#include "word.h"
+
+typedef struct bloom_s bloom_t;
+
+/** Map the filter of the wordlist \a bfp, for reading, or with \a
+ * writable for adding tokens, too.  \return NULL if the wordlist has
+ * no (usable) filter */
+bloom_t *bloom_open(const bfpath *bfp, bool writable);
+
+void bloom_close(/*@only@*/ bloom_t *bloom);
+
+/** Remap the filter if "bogoutil --build-filter" replaced it, or map
+ * it if one was built since, or drop it if it was removed.  To be
+ * called at the start of each transaction. */
+bloom_t *bloom_check(/*@only@*/ bloom_t *bloom, const bfpath *bfp, bool writable);
+
+/** \return false if \a token is certainly not in the wordlist. */
+bool bloom_maybe(const bloom_t *bloom, const word_t *token);
+
+/** Add \a token to the filter. */
+void bloom_add(bloom_t *bloom, const word_t *token);
+
+/** Build the filter of the wordlist, for bogoutil --build-filter. */
+ex_t build_filter_file(bfpath *bfp);
+
+#endif	/* BLOOM_H */
@@ -52,6 +52,7 @@ Note: bogolexer also uses configfile.c.
 #include "longoptions.h"
 #include "maint.h"
 #include "paths.h"
+#include "perfstats.h"
 #include "score.h"
 #include "wordlists.h"
 #include "wordlists_base.h"
@@ -171,6 +172,23 @@ static bool get_double(const char *name, const char *arg, double *d)
     return true;
 }
 
+static uint get_uint(const char *name, const char *arg)
+{
+    char *s = xstrdup(arg);
+    int i;
+
+    remove_comment(s);
+    if (!xatoi(&i, s) || i < 0) {
+	fprintf(stderr, "Invalid value '%s' for %s, expected a number of 0 or more.\n",
+		s, name);
+	exit(EX_ERROR);
+    }
+    if (DEBUG_CONFIG(2))
+	fprintf(dbgout, "%s -> %d\n", name, i);
+    xfree(s);
+    return (uint) i;
+}
+
 static char *get_string(const char *name, const char *arg)
 {
     char *s = xstrdup(arg);
@@ -277,6 +295,15 @@ static ex_t validate_args(void)
 	return EX_ERROR;
     }
 
+    /* the limits are for scoring: a registration, including that of
+     * -u, would store the counts of a partial message */
+    if (run_register || (run_type & RUN_UPDATE)) {
+	header_only = false;
+	max_message_bytes = 0;
+	max_message_tokens = 0;
+	early_exit_interval = 0;
+    }
+
     return EX_OK;
 }
 
@@ -320,6 +347,8 @@ static const char *help_text[] = {
     "  -q, --quiet               - suppress token statistics.\n",
     "  -U, --report-unsure       - print statistics if spamicity is 'unsure'.\n",
     "  -v, --verbosity           - set debug verbosity level.\n",
+    "      --stats-json          - print time spent per phase and counters as JSON,\n"
+    "                              with -vvv also for each message.\n",
     "  -y, --timestamp-date      - set date for token timestamps.\n",
     "  -D, --debug-to-stdout     - direct debug output to stdout.\n",
     "  -x, --debug-flags=list    - set flags to display debug information.\n",
@@ -330,6 +359,7 @@ static const char *help_text[] = {
     "  --bogofilter-dir                  directory for wordlists\n",
     "  --charset-default                 default character set\n",
     "  --db-cachesize                    Berkeley db cache in Mb\n",
+    "  --db-snapshot-reads               scoring doesn't wait for registering\n",
 #ifdef	HAVE_DECL_DB_CREATE
     "  --db-log-autoremove               enable/disable autoremoval of log files\n",
     "  --db-transaction                  enable/disable transactions\n",
@@ -337,17 +367,25 @@ static const char *help_text[] = {
     "  --db-txn-durable                                 \n",
  #endif
 #endif
+    "  --early-exit-interval             tokens between early scorings\n",
     "  --ham-cutoff                      nonspam if score below this\n",
     "  --header-format                   spam header format\n",
+    "  --header-only                     score the message header only\n",
+    "  --journal-overlay                 score with the unfolded journal\n",
+    "  --key-encoding                    code the tags of new wordlists' keys\n",
     "  --log-header-format               header written to log\n",
     "  --log-update-format               logged on update\n",
     "  --min-dev                         ignore if score near\n",
     "  --min-token-len                   min len for single tokens\n",
     "  --max-token-len                   max len for single tokens\n",
     "  --max-multi-token-len             max len for multi-word tokens\n",
+    "  --max-message-bytes               bytes of a message to read\n",
+    "  --max-message-tokens              tokens of a message to collect\n",
     "  --multi-token-count               number of tokens per multi-word token\n",
+    "  --negative-cache                  look tokens up in the filter first\n",
     "  --ns-esf                          effective size factor for ham\n",
     "  --replace-nonascii-characters     substitute '?' if bit 8 is 1\n",
+    "  --replication-log                 log registrations for export\n",
     "  --robs                            Robinson's s parameter\n",
     "  --robx                            Robinson's x parameter\n",
     "  --sp-esf                          effective size factor for spam\n",
@@ -368,6 +406,7 @@ static const char *help_text[] = {
     "  --unicode                         enable/disable unicode based wordlist\n",
 #endif
     "  --unsure-subject-tag              like spam-subject-tag\n",
+    "  --update-journal                  -u appends to a journal\n",
     "  --user-config-file                configuration file\n",
     "  --wordlist                        specify wordlist parameters\n",
     "\n",
@@ -539,6 +578,10 @@ int process_arg(int option, const char *name, const char *val, priority_t preced
 	nonspam_exits_zero = true;
 	break;
 
+    case O_STATS_JSON:
+	perfstats_enabled = true;
+	break;
+
     case 'h':
 	help(stdout);
 	exit(EX_OK);
@@ -720,6 +763,11 @@ int process_arg(int option, const char *name, const char *val, priority_t preced
 
     case O_BLOCK_ON_SUBNETS:		block_on_subnets = get_bool(name, val);			break;
     case O_CHARSET_DEFAULT:		xfree(charset_default); charset_default = get_string(name, val);		break;
+    case O_EARLY_EXIT_INTERVAL:		early_exit_interval = get_uint(name, val);		break;
+    case O_HEADER_ONLY:			header_only = get_bool(name, val);			break;
+    case O_JOURNAL_OVERLAY:		journal_overlay = get_bool(name, val);			break;
+    case O_MAX_MESSAGE_BYTES:		max_message_bytes = get_uint(name, val);		break;
+    case O_MAX_MESSAGE_TOKENS:		max_message_tokens = get_uint(name, val);		break;
     case O_HEADER_FORMAT:		xfree(header_format); header_format = get_string(name, val);			break;
     case O_LOG_HEADER_FORMAT:		xfree(log_header_format); log_header_format = get_string(name, val);		break;
     case O_LOG_UPDATE_FORMAT:		xfree(log_update_format); log_update_format = get_string(name, val);		break;
@@ -741,11 +789,16 @@ int process_arg(int option, const char *name, const char *val, priority_t preced
     case O_TOKEN_COUNT_FIX:             token_count_fix = atoi(val);                            break;
     case O_TOKEN_COUNT_MIN:             token_count_min = atoi(val);                            break;
     case O_TOKEN_COUNT_MAX:             token_count_max = atoi(val);                            break;
+    case O_UPDATE_JOURNAL:		update_journal = get_bool(name, val);			break;
     case O_UNSURE_SUBJECT_TAG:		xfree(unsure_subject_tag); unsure_subject_tag = get_string(name, val);		break;
     case O_UNICODE:			encoding = get_bool(name, val) ? E_UNICODE : E_RAW;	break;
     case O_WORDLIST:			configure_wordlist(val);				break;
 
     case O_DB_TRANSACTION:		eTransaction = get_txn(name, val);			break;
+    case O_DB_SNAPSHOT_READS:		db_snapshot_reads = get_bool(name, val);		break;
+    case O_REPLICATION_LOG:		replication_log = get_bool(name, val);			break;
+    case O_NEGATIVE_CACHE:		negative_cache = get_bool(name, val);			break;
+    case O_KEY_ENCODING:		key_encoding = get_bool(name, val);			break;
 
     default:
 #ifndef	DISABLE_TRANSACTIONS
@@ -783,6 +836,11 @@ rc_t query_config(void)
     Q3 fprintf(stdout, "%-17s = %d\n",    "token-count-min",     token_count_min);
     Q3 fprintf(stdout, "%-17s = %d\n",    "token-count-max",     token_count_max);
     Q3 fprintf(stdout, "\n");
+    Q3 fprintf(stdout, "%-17s = %s\n",    "header-only",         YN(header_only));
+    Q3 fprintf(stdout, "%-17s = %u\n",    "max-message-bytes",   max_message_bytes);
+    Q3 fprintf(stdout, "%-17s = %u\n",    "max-message-tokens",  max_message_tokens);
+    Q3 fprintf(stdout, "%-17s = %u\n",    "early-exit-interval", early_exit_interval);
+    Q3 fprintf(stdout, "\n");
     Q1 fprintf(stdout, "%-17s = %s\n",    "block-on-subnets",    YN(block_on_subnets));
     Q1 fprintf(stdout, "%-17s = %s\n",    "encoding",		 (encoding != E_UNICODE) ? "raw" : "utf-8");
     Q1 fprintf(stdout, "%-17s = %s\n",    "charset-default",     charset_default);
@@ -817,8 +875,16 @@ rc_t query_config(void)
     Q2 display_wordlists(word_lists, "%-18s   ");
     Q2 fprintf(stdout, "\n");
 
+    Q2 fprintf(stdout, "%-18s = %s\n", "update-journal",        YN(update_journal));
+    Q2 fprintf(stdout, "%-18s = %s\n", "journal-overlay",       YN(journal_overlay));
+    Q2 fprintf(stdout, "%-18s = %s\n", "replication-log",       YN(replication_log));
+    Q2 fprintf(stdout, "%-18s = %s\n", "negative-cache",        YN(negative_cache));
+    Q2 fprintf(stdout, "%-18s = %s\n", "key-encoding",          YN(key_encoding));
+    Q2 fprintf(stdout, "\n");
+
 #ifndef	DISABLE_TRANSACTIONS
     Q2 fprintf(stdout, "%-18s = %lu\n", "db-cachesize",         (unsigned long)db_cachesize);
+    Q2 fprintf(stdout, "%-18s = %s\n", "db-snapshot-reads",     YN(db_snapshot_reads));
 
 #ifdef	ENABLE_TRANSACTIONS
 #ifdef	HAVE_DECL_DB_CREATE
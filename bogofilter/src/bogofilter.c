@@ -33,7 +33,9 @@ THEORY:
 #include "bogoreader.h"
 #include "collect.h"
 #include "format.h"
+#include "lexer.h"
 #include "passthrough.h"
+#include "perfstats.h"
 #include "register.h"
 #include "rstats.h"
 #include "score.h"
@@ -60,6 +62,15 @@ THEORY:
 
 /* Function Definitions */
 
+/* register for -u, or append to the journal for bogoutil --fold-journal */
+static void update_words(run_t _run_type, wordhash_t *h, u_int32_t msgcount)
+{
+    if (update_journal)
+	journal_words(_run_type, h, msgcount);
+    else
+	register_words(_run_type, h, msgcount);
+}
+
 void print_stats(FILE *fp)
 {
     msg_print_stats(fp);
@@ -92,8 +103,9 @@ rc_t bogofilter(int argc, char **argv)
 	rstats_init();
 	passthrough_setup();
 
+	PERFSTATS_PHASE(PH_COLLECT);
 	collect_words(w);
-	wordhash_sort(w);
+	PERFSTATS_PHASE(PH_OTHER);
 	msgcount += 1;
 
 	format_set_counts(w->count, msgcount);
@@ -103,23 +115,30 @@ rc_t bogofilter(int argc, char **argv)
         
 	if (register_opt && DEBUG_REGISTER(1))
 	    fprintf(dbgout, "Message #%ld\n", (long) msgcount);
-	if (register_bef)
+	if (register_bef) {
+	    PERFSTATS_PHASE(PH_REGISTER);
 	    register_words(run_type, w, 1);
+	    PERFSTATS_PHASE(PH_OTHER);
+	}
 	if (register_aft)
 	    wordhash_add(words, w, &wordprop_init);
 
 	if (classify_msg || write_msg) {
 	    double spamicity;
+	    PERFSTATS_PHASE(PH_LOOKUP);
 	    lookup_words(w);			/* This reads the database */
+	    PERFSTATS_PHASE(PH_SCORE);
 	    spamicity = msg_compute_spamicity(w);
 	    status = msg_status();
+	    PERFSTATS_PHASE(PH_REGISTER);
 	    if (run_type & RUN_UPDATE)		/* Note: don't register if RC_UNSURE */
 	    {
 		if (status == RC_SPAM && spamicity <= 1.0 - thresh_update)
-		    register_words(REG_SPAM, w, msgcount);
+		    update_words(REG_SPAM, w, msgcount);
 		if (status == RC_HAM && spamicity >= thresh_update)
-		    register_words(REG_GOOD, w, msgcount);
+		    update_words(REG_GOOD, w, msgcount);
 	    }
+	    PERFSTATS_PHASE(PH_OUTPUT);
 
 	    if (verbose && !passthrough && !quiet) {
 		const char *filename = (*reader_filename)();
@@ -132,6 +151,7 @@ rc_t bogofilter(int argc, char **argv)
 		write_log_message(status);
 		msgcount = 0;
 	    }
+	    PERFSTATS_PHASE(PH_OTHER);
 	}
 	wordhash_free(w);
 
@@ -141,20 +161,29 @@ rc_t bogofilter(int argc, char **argv)
 	if (DEBUG_MEMORY(2))
 	    MEMDISPLAY;
 
+	if (perfstats_enabled)
+	    perfstats_msg_end(dbgout, verbose >= 3);
+
 	if (fDie)
 	    exit(EX_ERROR);
     }
 
     bogoreader_fini();
 
+    if (DEBUG_LEXER(0))
+	lexer_print_stats(dbgout);
+
     if (DEBUG_MEMORY(1))
 	MEMDISPLAY;
 
     if (register_aft && ((run_type & RUN_UPDATE) == 0)) {
-	wordhash_sort(words);
+	PERFSTATS_PHASE(PH_REGISTER);
 	register_words(run_type, words, msgcount);
     }
 
+    if (perfstats_enabled)
+	perfstats_print_totals(dbgout);
+
     score_cleanup();
 
     if (logflag && register_opt)
@@ -24,9 +24,6 @@ AUTHOR:
 #include "wordlists.h"
 #include "xmalloc.h"
 
-static uint ham_only,  ham_hapax;
-static uint spam_only, spam_hapax;
-
 static uint mgood, mbad;
 
 #define	INTERVALS	20
@@ -35,6 +32,8 @@ static uint mgood, mbad;
 typedef struct rhistogram_s rhistogram_t;
 struct rhistogram_s {
     uint32_t count[INTERVALS];
+    uint ham_only,  ham_hapax;
+    uint spam_only, spam_hapax;
 };
 
 /* Function Prototypes */
@@ -46,7 +45,7 @@ static ex_t ds_histogram_hook(/*@unused@*/ word_t *key, dsv_t *data,
 {
     rhistogram_t *hist = (rhistogram_t *)userdata;
 
-    double fw = calc_prob(data->goodcount, data->spamcount, mgood, mbad);
+    double fw = calc_prob_uncached(data->goodcount, data->spamcount, mgood, mbad);
     uint idx = min(fw * INTERVALS, INTERVALS-1);
 
     /* ignore meta-tokens */
@@ -56,20 +55,34 @@ static ex_t ds_histogram_hook(/*@unused@*/ word_t *key, dsv_t *data,
     hist->count[idx] += 1;
 
     if (data->spamcount == 0) {
-	ham_only += 1;
+	hist->ham_only += 1;
 	if (data->goodcount == 1)
-	    ham_hapax += 1;
+	    hist->ham_hapax += 1;
     }
 
     if (data->goodcount == 0) {
-	spam_only += 1;
+	hist->spam_only += 1;
 	if (data->spamcount == 1)
-	    spam_hapax += 1;
+	    hist->spam_hapax += 1;
     }
 
     return EX_OK;
 }
 
+static void ds_histogram_merge(void *userdata, void *part)
+{
+    rhistogram_t *hist = (rhistogram_t *)userdata;
+    const rhistogram_t *hp = (const rhistogram_t *)part;
+    uint i;
+
+    for (i = 0; i < INTERVALS; i += 1)
+	hist->count[i] += hp->count[i];
+    hist->ham_only   += hp->ham_only;
+    hist->ham_hapax  += hp->ham_hapax;
+    hist->spam_only  += hp->spam_only;
+    hist->spam_hapax += hp->spam_hapax;
+}
+
 static int print_histogram(rhistogram_t *hist)
 {
     uint i, r;
@@ -80,14 +93,14 @@ static int print_histogram(rhistogram_t *hist)
 	(void)printf("Histogram\n");
 
     if (verbose == 1) {
-	hist->count[0]           -= ham_hapax;
-	hist->count[INTERVALS-1] -= spam_hapax;
+	hist->count[0]           -= hist->ham_hapax;
+	hist->count[INTERVALS-1] -= hist->spam_hapax;
 	(void)printf("Histogram without hapaxes\n");
     }
 
     if (verbose == 2) {
-	hist->count[0]           -= ham_only;
-	hist->count[INTERVALS-1] -= spam_only;
+	hist->count[0]           -= hist->ham_only;
+	hist->count[INTERVALS-1] -= hist->spam_only;
 	(void)printf("Histogram without pure ham and spam\n");
     }
 
@@ -154,7 +167,8 @@ ex_t histogram(bfpath *bfp)
     mbad = val.spamcount;
 
     memset(&hist, 0, sizeof(hist));
-    rc = ds_foreach(dsh, ds_histogram_hook, &hist);
+    rc = ds_foreach_parallel(dsh, scan_threads, ds_histogram_hook, &hist, sizeof(hist),
+			     ds_histogram_merge);
 
     if (DST_OK != ds_txn_commit(dsh)) {
 	ds_close(dsh);
@@ -169,12 +183,14 @@ ex_t histogram(bfpath *bfp)
     count = print_histogram(&hist);
 
     if (verbose > 0) {
-	printf("hapaxes:  ham %7u, spam %7u\n", ham_hapax, spam_hapax);
-	printf("   pure:  ham %7u, spam %7u\n", ham_only,  spam_only);
+	printf("hapaxes:  ham %7u, spam %7u\n", hist.ham_hapax, hist.spam_hapax);
+	printf("   pure:  ham %7u, spam %7u\n", hist.ham_only,  hist.spam_only);
     }
     else {
-	printf("hapaxes:  ham %7u (%5.2f%%), spam %7u (%5.2f%%)\n", ham_hapax, PCT(ham_hapax), spam_hapax, PCT(spam_hapax));
-	printf("   pure:  ham %7u (%5.2f%%), spam %7u (%5.2f%%)\n", ham_only,  PCT(ham_only),  spam_only,  PCT(spam_only));
+	printf("hapaxes:  ham %7u (%5.2f%%), spam %7u (%5.2f%%)\n",
+	       hist.ham_hapax, PCT(hist.ham_hapax), hist.spam_hapax, PCT(hist.spam_hapax));
+	printf("   pure:  ham %7u (%5.2f%%), spam %7u (%5.2f%%)\n",
+	       hist.ham_only,  PCT(hist.ham_only),  hist.spam_only,  PCT(hist.spam_only));
     }
 
     return rc;
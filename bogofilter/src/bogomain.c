@@ -56,8 +56,10 @@ ex_t bogomain(int argc, char **argv) /*@globals errno,stderr,stdout@*/
 	openlog("bogofilter", LOG_PID, LOG_MAIL);
 #endif
 
-    /* open all wordlists */
-    open_wordlists((run_type == RUN_NORMAL) ? DS_READ : DS_WRITE);
+    /* open all wordlists, -u with update_journal only reads them */
+    open_wordlists((run_type == RUN_NORMAL ||
+		    (run_type == RUN_UPDATE && update_journal))
+		   ? DS_READ : DS_WRITE);
 
     if (encoding == E_UNKNOWN)
 	encoding = E_DEFAULT;
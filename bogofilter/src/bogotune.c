@@ -30,6 +30,13 @@ AUTHORS:
 ** 	  2a. create wordprops from wordlists
 **    c. replace wordprops with wordcnts
 **    d. de-allocate resident wordlist
+**
+** 3. k-fold cross-validation ("-D -K num") flags
+**    a. read all messages
+**    b. add every message to the wordlist, assign it to a fold
+**    c. foreach fold, subtract its counts from the wordlist,
+**       replace its wordprops with wordcnts, and restore the counts
+**    d. de-allocate resident wordlist
 */
 
 /* Limitations:
@@ -47,6 +54,9 @@ AUTHORS:
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#ifdef	HAVE_FORK
+#include <sys/wait.h>
+#endif
 
 #include "bogotune.h"
 
@@ -110,6 +120,10 @@ AUTHORS:
 #define RX_MIN		0.4
 #define RX_MAX		0.6
 
+/* k-fold limits */
+#define	MIN_FOLDS	2
+#define	MAX_FOLDS	10
+
 enum e_verbosity {
     SUMMARY	   = 1,	/* summarize main loop iterations	*/
     TIME	   = 2, /* include timing info           	*/
@@ -174,6 +188,9 @@ static double *ns_scores;
 static double *sp_scores;
 static double user_robx = 0.0;		/* from option '-r value' */
 static uint   coerced_target = 0;	/* user supplied with '-T value' */
+static uint   fold_count = 0;		/* k-fold cross-validation, '-K num' */
+static double *ns_fold_scores;		/* scores in fold order (unsorted) */
+static double *sp_fold_scores;
 
 static uint   ncnt, nsum;		/* neighbor count and sum - for gfn() averaging */
 
@@ -366,30 +383,51 @@ static int compare_results(const void *const ir1, const void *const ir2)
     return 0;
 }
 
-/* Score all non-spam */
+/* Score one message list, appending to results */
 
-static void score_ns(double *results)
+static uint score_msglist(mlhead_t *list, double *results, uint count)
+{
+    mlitem_t *item;
+
+    for (item = list->head; item != NULL; item = item->next) {
+	wordhash_t *wh = item->wh;
+	double score = msg_compute_spamicity(wh);
+	results[count++] = score;
+	if ( -verbose == SCORE_DETAIL ||
+	    (-verbose >= SCORE_DETAIL && EPS < score && score < 1 - EPS))
+	    printf("%6u %0.16f\n", count-1, score);
+    }
+
+    return count;
+}
+
+/* Score all messages of a tunelist, scoring sets first, then folds */
+
+static uint score_tunelist(tunelist_t *tl, double *results)
 {
     uint i;
     uint count = 0;
 
+    verbose = -verbose;		/* disable bogofilter debug output */
+    for (i = 0; i < COUNTOF(tl->u.sets); i += 1)
+	count = score_msglist(tl->u.sets[i], results, count);
+    for (i = 0; i < tl->fold_cnt; i += 1)
+	count = score_msglist(tl->folds[i], results, count);
+    verbose = -verbose;		/* enable bogofilter debug output */
+
+    return count;
+}
+
+/* Score all non-spam */
+
+static void score_ns(double *results)
+{
+    uint count;
+
     if (verbose >= SCORE_DETAIL)
 	printf("ns:\n");
 
-    verbose = -verbose;		/* disable bogofilter debug output */
-    for (i = 0; i < COUNTOF(ns_msglists->u.sets); i += 1) {
-	mlhead_t *list = ns_msglists->u.sets[i];
-	mlitem_t *item;
-	for (item = list->head; item != NULL; item = item->next) {
-	    wordhash_t *wh = item->wh;
-	    double score = msg_compute_spamicity(wh);
-	    results[count++] = score;
-	    if ( -verbose == SCORE_DETAIL ||
-		(-verbose >= SCORE_DETAIL && EPS < score && score < 1 - EPS))
-		printf("%6u %0.16f\n", count-1, score);
-	}
-    }
-    verbose = -verbose;		/* enable bogofilter debug output */
+    count = score_tunelist(ns_msglists, results);
 
     qsort(results, count, sizeof(double), compare_descending);
 
@@ -420,26 +458,12 @@ static bool check_for_high_ns_scores(void)
 
 static void score_sp(double *results)
 {
-    uint i;
-    uint count = 0;
+    uint count;
 
     if (verbose >= SCORE_DETAIL)
 	printf("sp:\n");
 
-    verbose = -verbose;		/* disable bogofilter debug output */
-    for (i = 0; i < COUNTOF(sp_msglists->u.sets); i += 1) {
-	mlhead_t *list = sp_msglists->u.sets[i];
-	mlitem_t *item;
-	for (item = list->head; item != NULL; item = item->next) {
-	    wordhash_t *wh = item->wh;
-	    double score = msg_compute_spamicity(wh);
-	    results[count++] = score;
-	    if ( -verbose == SCORE_DETAIL ||
-		(-verbose >= SCORE_DETAIL && EPS < score && score < 1 - EPS))
-		printf("%6u %0.16f\n", count-1, score);
-	}
-    }
-    verbose = -verbose;		/* enable bogofilter debug output */
+    count = score_tunelist(sp_msglists, results);
 
     qsort(results, count, sizeof(double), compare_ascending);
 
@@ -460,6 +484,155 @@ static uint get_fn_count(uint count, double *results)
     return fn;
 }
 
+/* Score the messages of one fold, non-spam and spam */
+
+static void score_fold(uint f, double *ns, double *sp)
+{
+    mlitem_t *item;
+
+    for (item = ns_msglists->folds[f]->head; item != NULL; item = item->next)
+	*ns++ = msg_compute_spamicity(item->wh);
+    for (item = sp_msglists->folds[f]->head; item != NULL; item = item->next)
+	*sp++ = msg_compute_spamicity(item->wh);
+}
+
+#ifdef	HAVE_FORK
+static bool xfer_scores(int fd, double *scores, size_t count, bool rd)
+{
+    char *buf = (char *)scores;
+    size_t len = count * sizeof(double);
+
+    while (len > 0) {
+	ssize_t n = rd ? read(fd, buf, len) : write(fd, buf, len);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0)
+	    return false;
+	buf += n;
+	len -= n;
+    }
+
+    return true;
+}
+#endif
+
+/* score_folds()
+**
+**	Score all folds, each in its own worker process if possible.
+**	Leaves the scores in fold order in ns_fold_scores and
+**	sp_fold_scores, and sorted in ns_scores and sp_scores.
+*/
+
+static void score_folds(void)
+{
+    uint f;
+    uint ns_off = 0, sp_off = 0;
+#ifdef	HAVE_FORK
+    pid_t pid[MAX_FOLDS];
+    int   fds[MAX_FOLDS];
+#endif
+
+    verbose = -verbose;		/* disable bogofilter debug output */
+    fflush(stdout);
+
+    for (f = 0; f < fold_count; f += 1) {
+	double *ns = ns_fold_scores + ns_off;
+	double *sp = sp_fold_scores + sp_off;
+#ifdef	HAVE_FORK
+	int pfd[2];
+
+	pid[f] = -1;
+	if (pipe(pfd) == 0) {
+	    pid[f] = fork();
+	    if (pid[f] == 0) {
+		close(pfd[0]);
+		score_fold(f, ns, sp);
+		_exit((xfer_scores(pfd[1], ns, ns_msglists->folds[f]->count, false) &&
+		       xfer_scores(pfd[1], sp, sp_msglists->folds[f]->count, false))
+		      ? EX_OK : EX_ERROR);
+	    }
+	    close(pfd[1]);
+	    if (pid[f] < 0)
+		close(pfd[0]);
+	    fds[f] = pfd[0];
+	}
+	if (pid[f] < 0)		/* no worker, score it here */
+#endif
+	    score_fold(f, ns, sp);
+
+	ns_off += ns_msglists->folds[f]->count;
+	sp_off += sp_msglists->folds[f]->count;
+    }
+
+#ifdef	HAVE_FORK
+    ns_off = sp_off = 0;
+    for (f = 0; f < fold_count; f += 1) {
+	if (pid[f] > 0) {
+	    int status;
+	    bool ok = (xfer_scores(fds[f], ns_fold_scores + ns_off, ns_msglists->folds[f]->count, true) &&
+		       xfer_scores(fds[f], sp_fold_scores + sp_off, sp_msglists->folds[f]->count, true));
+	    close(fds[f]);
+	    while (waitpid(pid[f], &status, 0) < 0 && errno == EINTR)
+		continue;
+	    if (!ok || !WIFEXITED(status) || WEXITSTATUS(status) != EX_OK) {
+		fprintf(stderr, "Scoring of fold %u failed.\n", f);
+		exit(EX_ERROR);
+	    }
+	}
+	ns_off += ns_msglists->folds[f]->count;
+	sp_off += sp_msglists->folds[f]->count;
+    }
+#endif
+
+    verbose = -verbose;		/* enable bogofilter debug output */
+
+    memcpy(ns_scores, ns_fold_scores, ns_cnt * sizeof(double));
+    memcpy(sp_scores, sp_fold_scores, sp_cnt * sizeof(double));
+    qsort(ns_scores, ns_cnt, sizeof(double), compare_descending);
+    qsort(sp_scores, sp_cnt, sizeof(double), compare_ascending);
+
+    return;
+}
+
+/* fold_variance()
+**
+**	Count each fold's fp and fn at the current spam_cutoff
+**	and save their variance across folds.
+*/
+
+static void fold_variance(result_t *r)
+{
+    uint f, i;
+    uint ns_off = 0, sp_off = 0;
+    double fp_sum = 0.0, fp_sq = 0.0;
+    double fn_sum = 0.0, fn_sq = 0.0;
+
+    for (f = 0; f < fold_count; f += 1) {
+	uint ns_c = ns_msglists->folds[f]->count;
+	uint sp_c = sp_msglists->folds[f]->count;
+	uint fp = 0, fn = 0;
+
+	for (i = 0; i < ns_c; i += 1)
+	    if (ns_fold_scores[ns_off + i] >= spam_cutoff)
+		fp += 1;
+	for (i = 0; i < sp_c; i += 1)
+	    if (sp_fold_scores[sp_off + i] < spam_cutoff)
+		fn += 1;
+
+	fp_sum += fp; fp_sq += (double)fp * fp;
+	fn_sum += fn; fn_sq += (double)fn * fn;
+
+	ns_off += ns_c;
+	sp_off += sp_c;
+    }
+
+    /* sample variance */
+    r->fp_var = (fp_sq - fp_sum * fp_sum / fold_count) / (fold_count - 1);
+    r->fn_var = (fn_sq - fn_sum * fn_sum / fold_count) / (fold_count - 1);
+
+    return;
+}
+
 static bool check_for_low_sp_scores(void)
 {
     uint t = ceil(sp_cnt * check_percent);
@@ -731,7 +904,7 @@ static void write_msgcount_file(wordhash_t *wh)
 	wordcnts_t *cnts = &wp->cnts;
 
 	if (cnts->good == 0 && cnts->bad == 0) {
-	    wp = (wordprop_t *)wordhash_search(train, token, 0);
+	    wp = (wordprop_t *)wordhash_search_hashed(train, token, hn->hash);
 	    if (wp) {
 		cnts->good = wp->cnts.good;
 		cnts->bad  = wp->cnts.bad;
@@ -818,6 +991,9 @@ static uint filelist_read(int mode, flhead_t *list)
 **	If only 2500 messages, use 2000 for training and 500 for scoring.
 **	If over 4000 messages, use equal numbers for training and scoring.
 **	In between 2500 and 4000, do a proportional distribution.
+**
+**	For k-fold cross-validation, all messages are used for training
+**	and for scoring, each being assigned round robin to a fold.
 */
 
 static void distribute(int mode, tunelist_t *ns_or_sp)
@@ -825,7 +1001,8 @@ static void distribute(int mode, tunelist_t *ns_or_sp)
     int good = mode == REG_GOOD;
     int bad  = 1 - good;
 
-    bool divvy = ds_flag == DS_RAM && user_robx < EPS && !msg_count_file;
+    bool folds = fold_count != 0;
+    bool divvy = !folds && ds_flag == DS_RAM && user_robx < EPS && !msg_count_file;
 
     mlitem_t *item;
     mlhead_t *msgs = ns_or_sp->msgs;
@@ -845,8 +1022,17 @@ static void distribute(int mode, tunelist_t *ns_or_sp)
     for (item = msgs->head; item != NULL; item = item->next) {
 	wordhash_t *wh = item->wh;
 
+	/* training and scoring set */
+	if (folds) {
+	    wordhash_set_counts(wh, good, bad);
+	    msglist_add(ns_or_sp->folds[score_count % fold_count], wh);
+	    train_count += 1;
+	    score_count += 1;
+	    train_good += good;
+	    train_bad  += bad;
+	}
 	/* training set */
-	if (divvy && train_count / ratio < score_count + 1) {
+	else if (divvy && train_count / ratio < score_count + 1) {
 	    wordhash_set_counts(wh, good, bad);
 	    wordhash_add(train, wh, &wordprop_init);
 	    train_count += 1;
@@ -863,7 +1049,7 @@ static void distribute(int mode, tunelist_t *ns_or_sp)
 	item->wh = NULL;
     }
 
-    if (divvy) {
+    if (divvy || folds) {
 	wordhash_insert(train, w_msg_count, sizeof(wordprop_t), &wordprop_init);
 	set_msg_counts(train_good, train_bad);
     }
@@ -897,6 +1083,63 @@ static void create_countlists(tunelist_t *ns_or_sp)
     return;
 }
 
+static void msglist_set_counts(mlhead_t *list, int good, int bad)
+{
+    mlitem_t *item;
+
+    for (item = list->head; item != NULL; item = item->next)
+	wordhash_set_counts(item->wh, good, bad);
+}
+
+static void fold_countlist(mlhead_t *list, mlhead_t *props)
+{
+    mlitem_t *item;
+
+    for (item = list->head; item != NULL; item = item->next) {
+	wordhash_t *who = item->wh;
+	item->wh = convert_propslist_to_countlist(who);
+	msglist_add(props, who);
+    }
+}
+
+/* create_fold_countlists()
+**
+**	Each fold's training counts are the totals less the fold's own
+**	counts.  Subtract the fold's messages from the shared totals,
+**	convert them to count format, then add them back.
+*/
+
+static void create_fold_countlists(void)
+{
+    uint f;
+    uint total_good = msgs_good;
+    uint total_bad  = msgs_bad;
+
+    for (f = 0; f < fold_count; f += 1) {
+	mlhead_t *ns = ns_msglists->folds[f];
+	mlhead_t *sp = sp_msglists->folds[f];
+	mlhead_t *ns_props = msglist_new("ns_props");
+	mlhead_t *sp_props = msglist_new("sp_props");
+
+	msglist_set_counts(ns, -1,  0);
+	msglist_set_counts(sp,  0, -1);
+	set_msg_counts(total_good - ns->count, total_bad - sp->count);
+
+	fold_countlist(ns, ns_props);
+	fold_countlist(sp, sp_props);
+
+	msglist_set_counts(ns_props, 1, 0);
+	msglist_set_counts(sp_props, 0, 1);
+
+	msglist_free(ns_props);
+	msglist_free(sp_props);
+    }
+
+    set_msg_counts(total_good, total_bad);
+
+    return;
+}
+
 static void print_version(void)
 {
     (void)fprintf(stderr,
@@ -924,6 +1167,7 @@ static void help(void)
 		  "\t  -D      - don't read a wordlist file.\n"
 		  "\t  -d path - specify directory for wordlists.\n"
 		  "\t  -E      - disable ESF (effective size factor) tuning.\n"
+		  "\t  -K num  - with -D, use num-fold cross-validation.\n"
 		  "\t  -M file - rewrite input file in message count format.\n"
 		  "\t  -r num  - specify robx value\n");
     (void)fprintf(stderr,
@@ -960,7 +1204,7 @@ static int process_arglist(int argc, char **argv)
     _wildcard (&argc, &argv);	/* expand wildcards (*.*) */
 #endif
 
-#define	OPTIONS	":-:c:Cd:DeEM:n:qr:s:tT:vVx:"
+#define	OPTIONS	":-:c:Cd:DeEK:M:n:qr:s:tT:vVx:"
 
     while (1)
     {
@@ -986,6 +1230,11 @@ static int process_arglist(int argc, char **argv)
 	exit(EX_ERROR);
     }
 
+    if (fold_count != 0 && ds_flag != DS_RAM) {
+	fprintf(stderr, "The '-K num' option requires the '-D' option.\n");
+	exit(EX_ERROR);
+    }
+
     if (bogolex_file == NULL &&
 	(spam_files->count == 0 || ham_files->count == 0)) {
 	fprintf(stderr,
@@ -1047,6 +1296,15 @@ int process_arg(int option, const char *name, const char *val, priority_t preced
 	esf_flag ^= true;
 	break;
 
+    case 'K':
+	fold_count = atoi(val);
+	if (fold_count < MIN_FOLDS || fold_count > MAX_FOLDS) {
+	    fprintf(stderr, "Fold count must be between %u and %u.\n",
+		    MIN_FOLDS, MAX_FOLDS);
+	    exit(EX_ERROR);
+	}
+	break;
+
     case 'M':
 	bogolex_file = val;
 	break;
@@ -1175,7 +1433,8 @@ static void top_ten(result_t *sorted, uint n)
 
     printf("Top ten parameter sets from this scan:\n");
 
-    printf("        rs     md    rx    spesf    nsesf    co     fp  fn   fppc   fnpc\n");
+    printf("        rs     md    rx    spesf    nsesf    co     fp  fn   fppc   fnpc%s\n",
+	   fold_count ? "  fpvar  fnvar" : "");
     for (f = false; !f; f = true) {
       for (i = j = 0; i < 10 && j < n;) {
  	result_t *r = &sorted[j++];
@@ -1183,9 +1442,12 @@ static void top_ten(result_t *sorted, uint n)
 	sp_esf = ESF_SEL(sp_esf, pow(0.75, r->sp_exp));
 	ns_esf = ESF_SEL(ns_esf, pow(0.75, r->ns_exp));
 
-	printf("%5u %6.4f %5.3f %5.3f %8.6f %8.6f %6.4f  %3u %3u  %6.4f %6.4f\n",
+	printf("%5u %6.4f %5.3f %5.3f %8.6f %8.6f %6.4f  %3u %3u  %6.4f %6.4f",
 	       r->idx, r->rs, r->md, r->rx, sp_esf, ns_esf, r->co,
 	       r->fp, r->fn, r->fp*100.0/ns_cnt, r->fn*100.0/sp_cnt);
+	if (fold_count)
+	    printf(" %6.2f %6.2f", r->fp_var, r->fn_var);
+	printf("\n");
 	++i;
       }
       if (i) break;
@@ -1426,6 +1688,8 @@ static void bogotune_free(void)
 {
     xfree(ns_scores);
     xfree(sp_scores);
+    xfree(ns_fold_scores);
+    xfree(sp_fold_scores);
 
     filelist_free(ham_files);
     filelist_free(spam_files);
@@ -1546,9 +1810,21 @@ static rc_t bogotune(void)
 	show_elapsed_time(beg, end, ns_cnt + sp_cnt, (double)cnt/(end-beg), "messages", "msg/sec");
     }
 
+    if (fold_count != 0) {
+	if (msg_count_file) {
+	    fprintf(stderr, "The '-K num' option can't be used with message count files.\n");
+	    exit(EX_ERROR);
+	}
+	tunelist_set_folds(ns_msglists, fold_count);
+	tunelist_set_folds(sp_msglists, fold_count);
+    }
+
     distribute(REG_GOOD, ns_msglists);
     distribute(REG_SPAM, sp_msglists);
 
+    if (fold_count != 0)
+	create_fold_countlists();
+
     create_countlists(ns_msglists);
     create_countlists(sp_msglists);
 
@@ -1577,6 +1853,11 @@ static rc_t bogotune(void)
     ns_scores = (double *)xcalloc(ns_cnt, sizeof(double));
     sp_scores = (double *)xcalloc(sp_cnt, sizeof(double));
 
+    if (fold_count != 0) {
+	ns_fold_scores = (double *)xcalloc(ns_cnt, sizeof(double));
+	sp_fold_scores = (double *)xcalloc(sp_cnt, sizeof(double));
+    }
+
     robs = DEFAULT_ROBS;
     robx = DEFAULT_ROBX;
     min_dev = DEFAULT_MIN_DEV;
@@ -1678,8 +1959,11 @@ static rc_t bogotune(void)
 		printf("%3s ", "cnt");
 	    if (verbose >= SUMMARY+2)
 		printf(" %s %s %s      ", "s", "m", "x");
-	    printf(" %4s %5s   %4s %8s %8s %7s %3s %3s\n",
+	    printf(" %4s %5s   %4s %8s %8s %7s %3s %3s",
 		   "rs", "md", "rx", "spesf", "nsesf", "cutoff", "fp", "fn");
+	    if (fold_count != 0)
+		printf(" %6s %6s", "fpvar", "fnvar");
+	    printf("\n");
 	}
 
 	cnt = 0;
@@ -1719,7 +2003,10 @@ static rc_t bogotune(void)
 		    }
 
 		    spam_cutoff = 0.01;
-		    score_ns(ns_scores);	/* scores in descending order */
+		    if (fold_count == 0)
+			score_ns(ns_scores);	/* scores in descending order */
+		    else
+			score_folds();		/* all folds, ns and sp */
 
 		    /* Determine spam_cutoff and false_pos */
 		    for (fp = target; fp < ns_cnt; fp += 1) {
@@ -1733,7 +2020,8 @@ static rc_t bogotune(void)
 			fprintf(stderr,
 				"Too few false positives to determine a valid cutoff\n");
 
-		    score_sp(sp_scores);	/* scores in ascending order */
+		    if (fold_count == 0)
+			score_sp(sp_scores);	/* scores in ascending order */
 		    fn = get_fn_count(sp_cnt, sp_scores);
 
 		    /* save results */
@@ -1741,10 +2029,16 @@ static rc_t bogotune(void)
 		    r->fp = fp;
 		    r->fn = fn;
 
+		    if (fold_count != 0)
+			fold_variance(r);
+
 		    if (verbose < SUMMARY)
 			progress(cnt, r_count);
 		    else {
-			printf(" %8.6f %2u %3u\n", spam_cutoff, fp, fn);
+			printf(" %8.6f %2u %3u", spam_cutoff, fp, fn);
+			if (fold_count != 0)
+			    printf(" %6.2f %6.2f", r->fp_var, r->fn_var);
+			printf("\n");
 			fflush(stdout);
 		    }
 
@@ -1798,6 +2092,9 @@ static rc_t bogotune(void)
 	printf("        fp %u (%6.4f%%), fn %u (%6.4f%%)\n",
 		best->fp, best->fp*100.0/ns_cnt,
 		best->fn, best->fn*100.0/sp_cnt);
+	if (fold_count != 0)
+	    printf("        %u folds, fp variance %6.2f, fn variance %6.2f\n",
+		   fold_count, best->fp_var, best->fn_var);
 	printf("\n");
 
 	data_free(rsval);
@@ -27,6 +27,9 @@ typedef struct result_s {
 
     uint fp;
     uint fn;
+
+    double fp_var;	/* variance across folds ('-K') */
+    double fn_var;
 } result_t;
 
 #endif
@@ -21,13 +21,16 @@ AUTHORS:
 
 #include "bogoconfig.h"
 #include "bogofilter.h"
+#include "bloom.h"
 #include "bogohist.h"
 #include "bool.h"
 #include "buff.h"
 #include "configfile.h"
 #include "datastore.h"
 #include "datastore_db.h"
+#include "delta.h"
 #include "error.h"
+#include "journal.h"
 #include "longoptions.h"
 #include "maint.h"
 #include "msgcounts.h"
@@ -130,8 +133,9 @@ static byte *spanword(byte *t)
 }
 
 /** determines if the token is a regular token or a special non-count
- * token (.ROBX, .WORDLIST_VERSION), returns true if the token is a
- * count token */
+ * token (.ROBX, .WORDLIST_VERSION, .KEY_ENCODING), returns true if the
+ * token is a count token.  Special tokens are not loaded: they describe
+ * the wordlist that was dumped, and the loading one has its own. */
 static bool is_count(const char *in)
 {
     static const char *const msgc = MSG_COUNT;
@@ -473,9 +477,11 @@ static void print_version(void)
 static void usage(FILE *fp)
 {
     fprintf(fp, "Usage: %s {-h|-V}\n", progname);
-    fprintf(fp, "   or: %s [OPTIONS] {-d|-l|-u|-m|-w|-p|--db-verify} file%s\n",
+    fprintf(fp, "   or: %s [OPTIONS] {-d|-l|-u|-m|-w|-p|--db-verify|--precompute|--fold-journal|--build-filter} file%s\n",
 	    progname, DB_EXT);
     fprintf(fp, "   or: %s [OPTIONS] {-H|-r|-R} file\n", progname);
+    fprintf(fp, "   or: %s [OPTIONS] {--export-delta|--apply-delta} file%s\n",
+	    progname, DB_EXT);
 #if defined (ENABLE_DB_DATASTORE) || defined (ENABLE_SQLITE_DATASTORE)
     fprintf(fp, "   or: %s [OPTIONS] {--db-print-leafpage-count} file%s\n",
 	    progname, DB_EXT);
@@ -502,6 +508,14 @@ static const char *help_text[] = {
 #ifdef	ENABLE_DB_DATASTORE
     "  -k, --db-cachesize=size     - set Berkeley DB cache size (MB).\n",
 #endif
+    "      --db-snapshot-reads=yes/no\n"
+    "                              - don't make readers wait for writers.\n",
+    "      --replication-log=yes/no\n"
+    "                              - log registrations for --export-delta.\n",
+    "      --negative-cache=yes/no\n"
+    "                              - look tokens up in the filter first.\n",
+    "      --key-encoding=yes/no\n"
+    "                              - code the tags of the keys of new wordlists.\n",
     "  -v, --verbosity             - set debug verbosity level.\n",
     "  -x, --debug-flags=list      - set flags to display debug information.\n",
     "  -y, --timestamp-date=date   - set default date (format YYYYMMDD).\n",
@@ -525,6 +539,11 @@ static const char *help_text[] = {
     "                                - use with -vv to exclude pure spam/ham.\n",
     "  -r file                     - compute Robinson's X for the specified file.\n",
     "  -R file                     - compute Robinson's X and save it in wordlist.\n",
+    "  --precompute=file           - store token probabilities in wordlist.\n",
+    "  --robs=value                - Robinson's s for --precompute.\n",
+    "  --robx=value                - Robinson's x for --precompute.\n",
+    "  --scan-threads=num          - read the wordlist with 'num' threads for\n"
+    "                                -H, -r, -R and -m (if it only expires).\n",
     "\n",
 
     "database maintenance, the \"-m file\" option is required in this group:\n",
@@ -534,9 +553,22 @@ static const char *help_text[] = {
     "  -c cnt                      - exclude tokens with lower counts.\n",
     "  -s l,h                      - exclude tokens with lengths between 'l' and 'h'\n"
     "                                (low and high).\n",
+    "  --maint-chunk=num           - commit every 'num' tokens, resume where an\n"
+    "                                interrupted run stopped.\n",
 #ifndef	DISABLE_UNICODE
     "  --unicode=yes/no            - convert wordlist to/from unicode\n",
 #endif
+    "  --fold-journal=file         - add the journal of bogofilter -u with\n"
+    "                                update-journal to the wordlist.\n",
+    "  --build-filter=file         - build the filter of the wordlist's tokens\n"
+    "                                for negative-cache.\n",
+    "\n",
+
+    "replication options, for merging the wordlists of several nodes:\n",
+    "  --export-delta=file         - write the changes since the last export\n"
+    "                                to stdout (needs replication-log).\n",
+    "  --apply-delta=file          - add the changes from another node, read\n"
+    "                                from stdin, to the wordlist.\n",
     "\n",
 
     "token parsing options:\n",
@@ -589,6 +621,15 @@ static struct option longopts_bogoutil[] = {
     { "db-recover-harder",              R, 0, O_DB_RECOVER_HARDER },
     { "db-remove-environment",		R, 0, O_DB_REMOVE_ENVIRONMENT },
     { "db-verify",                      R, 0, O_DB_VERIFY },
+    { "apply-delta",			R, 0, O_APPLY_DELTA },
+    { "build-filter",			R, 0, O_BUILD_FILTER },
+    { "export-delta",			R, 0, O_EXPORT_DELTA },
+    { "fold-journal",			R, 0, O_FOLD_JOURNAL },
+    { "maint-chunk",			R, 0, O_MAINT_CHUNK },
+    { "precompute",			R, 0, O_PRECOMPUTE },
+    { "robs",				R, 0, O_ROBS },
+    { "robx",				R, 0, O_ROBX },
+    { "scan-threads",			R, 0, O_SCAN_THREADS },
 
     /* end of list */
     { NULL,				0, 0, 0 }
@@ -828,6 +869,73 @@ int process_arg(int option, const char *name, const char *val, priority_t preced
 	ds_file = val;
 	break;
 
+    case O_PRECOMPUTE:
+	flag = M_PRECOMPUTE;
+	count += 1;
+	ds_file = val;
+	break;
+
+    case O_FOLD_JOURNAL:
+	flag = M_FOLD_JOURNAL;
+	count += 1;
+	ds_file = val;
+	break;
+
+    case O_BUILD_FILTER:
+	flag = M_BUILD_FILTER;
+	count += 1;
+	ds_file = val;
+	break;
+
+    case O_EXPORT_DELTA:
+	flag = M_EXPORT_DELTA;
+	count += 1;
+	ds_file = val;
+	break;
+
+    case O_APPLY_DELTA:
+	flag = M_APPLY_DELTA;
+	count += 1;
+	ds_file = val;
+	break;
+
+    case O_ROBS:
+	robs = atof(val);
+	break;
+
+    case O_ROBX:
+	robx = atof(val);
+	break;
+
+    case O_SCAN_THREADS:
+	scan_threads = (uint) atoi(val);
+	break;
+
+    case O_DB_SNAPSHOT_READS:
+	db_snapshot_reads = str_to_bool(val);
+	break;
+
+    case O_REPLICATION_LOG:
+	replication_log = str_to_bool(val);
+	break;
+
+    case O_NEGATIVE_CACHE:
+	negative_cache = str_to_bool(val);
+	break;
+
+    case O_KEY_ENCODING:
+	key_encoding = str_to_bool(val);
+	break;
+
+    case O_MAINT_CHUNK:
+	maintain = true;
+	maint_chunk = (uint) atoi(val);
+	if ((int) maint_chunk <= 0) {
+	    fprintf(stderr, "Invalid --maint-chunk value '%s', expected a number of tokens.\n", val);
+	    exit(EX_ERROR);
+	}
+	break;
+
     case O_UNICODE:
 	encoding = str_to_bool(val) ? E_UNICODE : E_RAW;
 	break;
@@ -864,11 +972,16 @@ static bfpath_mode get_mode(cmd_t cmd)
 
     switch (cmd) {
     case M_LOAD:
+    case M_APPLY_DELTA:
 	mode = BFP_MAY_CREATE;
 	break;
     case M_DUMP:
     case M_HIST:
     case M_MAINTAIN:
+    case M_PRECOMPUTE:
+    case M_FOLD_JOURNAL:
+    case M_BUILD_FILTER:
+    case M_EXPORT_DELTA:
     case M_ROBX:
     case M_VERIFY:
     case M_WORD:
@@ -1018,6 +1131,21 @@ int main(int argc, char *argv[])
 	case M_ROBX:
 	    rc = get_robx(bfp);
 	    break;
+	case M_PRECOMPUTE:
+	    rc = precompute_wordlist_file(bfp);
+	    break;
+	case M_FOLD_JOURNAL:
+	    rc = fold_journal_file(bfp);
+	    break;
+	case M_BUILD_FILTER:
+	    rc = build_filter_file(bfp);
+	    break;
+	case M_EXPORT_DELTA:
+	    rc = export_delta_file(bfp);
+	    break;
+	case M_APPLY_DELTA:
+	    rc = apply_delta_file(bfp);
+	    break;
 	case M_NONE:
 	default:
 	    /* should have been handled above */
@@ -6,7 +6,10 @@
 #include <stdlib.h>
 
 #include "charset.h"
+#include "lexer.h"
 #include "mime.h"
+#include "perfstats.h"
+#include "score.h"
 #include "wordhash.h"
 #include "token.h"
 
@@ -30,12 +33,31 @@ void wordcnts_incr(wordcnts_t *w1, wordcnts_t *w2)
     w1->bad  += w2->bad;
 }
 
+/* early_exit()
+**	score the tokens collected so far; true if the tokens still
+**	allowed by max_message_tokens cannot change the verdict
+*/
+static bool early_exit(wordhash_t *wh)
+{
+    if (early_exit_interval == 0 || max_message_tokens == 0)
+	return false;
+
+    return msg_score_settled(wh, max_message_tokens - min(wh->count, max_message_tokens));
+}
+
 /* Tokenize input text and save words in the wordhash_t hash table.
  *
- * Returns:  true if the EOF token has not been read.
+ * Collecting stops early at the end of the header with header_only,
+ * at max_message_tokens tokens, or when early_exit() says so; the
+ * rest of the message is then read without tokenizing it.  These
+ * limits are cleared for runs that register, see validate_args().
  */
 void collect_words(wordhash_t *wh)
 {
+    bool in_body = false;
+    bool stopped = false;
+    uint next_check = 0;
+
     if (DEBUG_WORDLIST(2)) fprintf(dbgout, "### collect_words() begins\n");
 
     lexer_init();
@@ -43,11 +65,27 @@ void collect_words(wordhash_t *wh)
     for (;;){
 	wordprop_t *wp;
 	word_t token;
+	uint hash;
+	phase_t prev = PERFSTATS_ENTER(PH_LEX);
 	token_t cls = get_token( &token );
 
+	PERFSTATS_LEAVE(prev);
+
 	if (cls == NONE)
 	    break;
 
+	PERFSTATS_COUNT(PC_TOKENS, 1);
+
+	/* first token after the message header */
+	if (!in_body && have_body && !msg_count_file) {
+	    in_body = true;
+	    if (header_only || early_exit(wh)) {
+		stopped = true;
+		break;
+	    }
+	    next_check = wh->count + early_exit_interval;
+	}
+
 	if (cls == BOGO_LEX_LINE)
 	{
 	    char *beg = (char *)token.u.text+1;	/* skip leading quote mark */
@@ -58,7 +96,10 @@ void collect_words(wordhash_t *wh)
 	    token.u.text[token.leng] = '\0';	/* ensure nul termination */
 	}
 
-	wp = (wordprop_t *)wordhash_insert(wh, &token, sizeof(wordprop_t), &wordprop_init);
+	if (cls != BOGO_LEX_LINE && get_token_hash(&hash))
+	    wp = (wordprop_t *)wordhash_insert_hashed(wh, &token, hash, sizeof(wordprop_t), &wordprop_init);
+	else
+	    wp = (wordprop_t *)wordhash_insert(wh, &token, sizeof(wordprop_t), &wordprop_init);
 	if (wh->type != WH_CNTS)
 	    wp->freq = 1;
 
@@ -104,7 +145,29 @@ void collect_words(wordhash_t *wh)
 	    wp->cnts.msgs_good = msgs_good;
 	    wp->cnts.msgs_bad = msgs_bad;
 	}
+
+	if (msg_count_file)
+	    continue;
+
+	if (max_message_tokens != 0 && wh->count >= max_message_tokens) {
+	    stopped = true;
+	    break;
+	}
+
+	if (in_body && early_exit_interval != 0 && wh->count >= next_check) {
+	    if (early_exit(wh)) {
+		stopped = true;
+		break;
+	    }
+	    next_check = wh->count + early_exit_interval;
+	}
     }
+
+    if (stopped || max_message_bytes != 0)
+	lexer_skip_message();
+
+    if (DEBUG_WORDLIST(2) && stopped)
+	fprintf(dbgout, "### collect_words() stopped early after %u tokens\n", wh->count);
     
     if (DEBUG_WORDLIST(2)) fprintf(dbgout, "### collect_words() ends\n");
 
@@ -163,6 +163,8 @@ typedef struct {
     double 	prob;
     int		freq;
     bool	used;
+    bool	precomputed;	/* prob read from the wordlist */
+    bool	looked_up;	/* cnts read from the wordlists */
 } wordprop_t;
 
 extern void bf_exit(void);
@@ -171,17 +173,21 @@ extern void bf_exit(void);
 
 typedef enum e_wordlist_version {
     ORIGINAL_VERSION = 0,
-    IP_PREFIX = 20040500	/* when IP prefixes were added */
+    IP_PREFIX = 20040500,	/* when IP prefixes were added */
+    PROB_RECORDS = 20260900,	/* when --precompute was added */
+    KEY_CODING = 20261000	/* when key_encoding was added */
 } t_wordlist_version;
 
-#define	CURRENT_VERSION	IP_PREFIX
+#define	CURRENT_VERSION	IP_PREFIX	/* of new wordlists */
+#define	NEWEST_VERSION	KEY_CODING	/* that this program can read */
 
 /* for bogoutil.c and datastore_db_trans.c */
 
 typedef enum { M_NONE, M_DUMP, M_LOAD, M_WORD, M_MAINTAIN, M_ROBX, M_HIST,
     M_LIST_LOGFILES, M_LEAFPAGES,
     M_RECOVER, M_CRECOVER, M_PURGELOGS, M_VERIFY, M_REMOVEENV, M_CHECKPOINT,
-    M_PAGESIZE }
+    M_PAGESIZE, M_PRECOMPUTE, M_FOLD_JOURNAL,
+    M_EXPORT_DELTA, M_APPLY_DELTA, M_BUILD_FILTER }
     cmd_t;
 
 #define BOGO_ASSERT(expr, msg) if (!(expr)) { fprintf(stderr, "%s: %s:%d %s\n", progname, __FILE__, __LINE__, msg); abort(); }
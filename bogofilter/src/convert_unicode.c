@@ -31,7 +31,7 @@ AUTHOR:
 #define	SP	' '
 
 #include <iconv.h>
-iconv_t cd = (iconv_t)-1;
+converter_t *cd = NULL;		/* current converter, for iconvert() */
 
 static void map_nonascii_characters(void)
 {
@@ -122,20 +122,115 @@ iconv_t bf_iconv_open( const char *to_charset, const char *from_charset )
     return xd;
 }
 
+/* Converter cache.  RFC 2047 encoded words and MIME parts switch
+** charsets often, so the most recently used converters are kept open
+** instead of calling iconv_open() and iconv_close() each time.
+*/
+
+#define	CV_CACHE_SIZE	8
+
+typedef struct cv_entry_s {
+    char	*from;
+    char	*to;
+    converter_t	 cv;
+    unsigned long used;		/* LRU stamp, 0 for a free slot */
+} cv_entry_t;
+
+static cv_entry_t cv_cache[CV_CACHE_SIZE];
+static unsigned long cv_clock;
+
+static bool name_in(const char *name, const char *const *list)
+{
+    for (; *list != NULL; list += 1)
+	if (strcasecmp(name, *list) == 0)
+	    return true;
+    return false;
+}
+
+static cv_kind_t builtin_kind(const char *to_charset, const char *from_charset)
+{
+    static const char *const utf8[]   = { "utf-8", "utf8", NULL };
+    static const char *const ascii[]  = { "us-ascii", "ascii", "ansi_x3.4-1968", NULL };
+    static const char *const latin1[] = { "iso-8859-1", "iso8859-1", "iso_8859-1",
+					  "latin1", "l1", NULL };
+    static const char *const cp1252[] = { "windows-1252", "cp1252", NULL };
+
+    if (!name_in(to_charset, utf8))
+	return CV_ICONV;
+    if (name_in(from_charset, utf8))
+	return CV_UTF8;
+    if (name_in(from_charset, ascii))
+	return CV_ASCII;
+    if (name_in(from_charset, latin1))
+	return CV_LATIN1;
+    if (name_in(from_charset, cp1252))
+	return CV_CP1252;
+    return CV_ICONV;
+}
+
+converter_t *bf_converter_get( const char *to_charset, const char *from_charset )
+{
+    uint i;
+    cv_entry_t *e, *victim = NULL;
+
+    cv_clock += 1;
+
+    for (i = 0; i < CV_CACHE_SIZE; i += 1) {
+	e = &cv_cache[i];
+	if (e->used != 0 &&
+	    strcasecmp(e->from, from_charset) == 0 &&
+	    strcasecmp(e->to, to_charset) == 0) {
+	    e->used = cv_clock;
+	    return &e->cv;
+	}
+	if (&e->cv == cd)		/* never evict the current converter */
+	    continue;
+	if (victim == NULL || e->used < victim->used)
+	    victim = e;
+    }
+
+    e = victim;
+    if (e->used != 0) {
+	if (e->cv.xd != (iconv_t)-1)
+	    iconv_close(e->cv.xd);
+	xfree(e->from);
+	xfree(e->to);
+    }
+
+    e->from = xstrdup(from_charset);
+    e->to   = xstrdup(to_charset);
+    e->used = cv_clock;
+    e->cv.kind = builtin_kind(to_charset, from_charset);
+    e->cv.xd = (e->cv.kind != CV_ICONV) ? (iconv_t)-1
+				       : bf_iconv_open( to_charset, from_charset );
+
+    if (DEBUG_ICONV(2))
+	fprintf(dbgout, "opened converter %s to %s (%s)\n", from_charset, to_charset,
+		(e->cv.kind == CV_ICONV) ? "iconv" : "built-in");
+
+    return &e->cv;
+}
+
+void bf_converter_reset(converter_t *cv)
+{
+    if (cv->xd != (iconv_t)-1)
+	iconv(cv->xd, NULL, NULL, NULL, NULL);
+}
+
 void init_charset_table_iconv(const char *from_charset, const char *to_charset)
 {
     uint idx;
 
-    if (cd != (iconv_t)-1)
-	iconv_close(cd);
-
     if (DEBUG_ICONV(1))
 	fprintf(dbgout, "converting %s to %s\n", from_charset, to_charset);
 
     if (strcasecmp( from_charset, "default" ) == 0)
 	from_charset = charset_default;
 
-    cd = bf_iconv_open( to_charset, from_charset );
+    /* a new part, or the start of a message, begins in the initial
+     * shift state */
+    cd = bf_converter_get( to_charset, from_charset );
+    bf_converter_reset(cd);
 
     for (idx = 0; idx < COUNTOF(charsets); idx += 1)
     {
@@ -13,12 +13,39 @@ AUTHOR:
 
 #include <iconv.h>
 
+/** built-in converters to UTF-8, used instead of iconv() for the
+ * most common charsets */
+typedef enum cv_kind_e {
+    CV_ICONV,		/**< use iconv() */
+    CV_ASCII,		/**< us-ascii */
+    CV_UTF8,		/**< utf-8, validated */
+    CV_LATIN1,		/**< iso-8859-1 */
+    CV_CP1252		/**< windows-1252 */
+} cv_kind_t;
+
+typedef struct converter_s {
+    cv_kind_t	kind;
+    iconv_t	xd;	/**< descriptor for CV_ICONV, else (iconv_t)-1 */
+} converter_t;
+
 extern void init_charset_table_iconv(const char *from_charset, 
 				     const char *to_charset);
 
 extern iconv_t bf_iconv_open( const char *to_charset, 
 			       const char *from_charset );
 
+/** get a converter from the cache, opening it if needed.  The
+ * converter stays valid until it is evicted, i.e. until a few other
+ * charset pairs have been used.  The caller must not close it.  A
+ * converter taken from the cache keeps the shift state of its last
+ * use, so that a part can be converted in several chunks. */
+extern converter_t *bf_converter_get( const char *to_charset,
+				      const char *from_charset );
+
+/** put a converter back into its initial shift state, for the start of
+ * a new text in a stateful charset such as ISO-2022-JP or UTF-7. */
+extern void bf_converter_reset( converter_t *cv );
+
 #if	defined(CP866) && !defined(ENABLE_UNICODE) && !defined(DISABLE_UNICODE)
 extern int  decode_and_htmlUNICODE_to_cp866(byte *buf, int len);
 #endif
@@ -16,6 +16,9 @@ David Relson <relson@osagesoftware.com>  2003 - 2009
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
+#ifdef	HAVE_PTHREAD_CREATE
+#include <pthread.h>
+#endif
 
 #include "datastore.h"
 #include "datastore_db.h"
@@ -23,6 +26,7 @@ David Relson <relson@osagesoftware.com>  2003 - 2009
 
 #include "error.h"
 #include "maint.h"
+#include "perfstats.h"
 #include "rand_sleep.h"
 #include "swap.h"
 #include "word.h"
@@ -107,12 +111,22 @@ static void convert_external_to_internal(dsh_t *dsh, dbv_const_t *ex_data, dsv_t
     if (ex_data->leng <= i * sizeof(uint32_t))
 	in_data->date = 0;
     else
-	in_data->date = !dsh->is_swapped ? cv[i] : swap_32bit(cv[i]);
+	in_data->date = !dsh->is_swapped ? cv[i++] : swap_32bit(cv[i++]);
+
+    /* precomputed probability, written by ds_write_prob() */
+    if (ex_data->leng < (i + 2) * sizeof(uint32_t)) {
+	in_data->prob_gen = 0;
+	in_data->prob = 0;
+    } else {
+	in_data->prob_gen = !dsh->is_swapped ? cv[i++] : swap_32bit(cv[i++]);
+	in_data->prob     = !dsh->is_swapped ? cv[i]   : swap_32bit(cv[i]);
+    }
 
     return;
 }
 
-static void convert_internal_to_external(dsh_t *dsh, dsv_t *in_data, dbv_t *ex_data)
+static void convert_internal_to_external(dsh_t *dsh, dsv_t *in_data, dbv_t *ex_data,
+					 bool with_prob)
 {
     size_t i = 0;
     uint32_t *cv = (uint32_t *)ex_data->data;
@@ -124,7 +138,13 @@ static void convert_internal_to_external(dsh_t *dsh, dsv_t *in_data, dbv_t *ex_d
     cv[i++] = !dsh->is_swapped ? in_data->spamcount : swap_32bit(in_data->spamcount);
     cv[i++] = !dsh->is_swapped ? in_data->goodcount : swap_32bit(in_data->goodcount);
 
-    if (timestamp_tokens && in_data->date != 0)
+    if (with_prob && in_data->prob_gen != 0) {
+	/* the date slot is needed to locate the probability */
+	cv[i++] = !dsh->is_swapped ? in_data->date : swap_32bit(in_data->date);
+	cv[i++] = !dsh->is_swapped ? in_data->prob_gen : swap_32bit(in_data->prob_gen);
+	cv[i++] = !dsh->is_swapped ? in_data->prob : swap_32bit(in_data->prob);
+    }
+    else if (timestamp_tokens && in_data->date != 0)
 	cv[i++] = !dsh->is_swapped ? in_data->date : swap_32bit(in_data->date);
 
     ex_data->leng = i * sizeof(cv[0]);
@@ -132,17 +152,279 @@ static void convert_internal_to_external(dsh_t *dsh, dsv_t *in_data, dbv_t *ex_d
     return;
 }
 
+/* Key encoding: most tokens start with the tag of the header field
+ * they come from, and multi-word tokens repeat it after each '*'.  In
+ * a wordlist with the KEY_ENCODING token, these tags are stored as a
+ * single byte, codes 1 to 9.  A key that has any of the bytes 1 to
+ * KEY_ESCAPE itself is stored verbatim, after KEY_ESCAPE.  Special
+ * tokens such as KEY_ENCODING start with '.' and so keep their keys. */
+
+#define	KEY_ESCAPE	0x0f
+
+static const char *const key_tags[] = {
+    NULL, "head:", "subj:", "from:", "to:", "rtrn:", "rcvd:", "mime:", "url:", "ip:"
+};
+
+#define	KEY_TAGS	(sizeof(key_tags) / sizeof(key_tags[0]))
+#define	MAX_TAG_LEN	5
+
+static void grow_buffer(byte **buf, size_t *size, size_t need)
+{
+    if (*size < need) {
+	*size = need + 64;
+	*buf = (byte *)xrealloc(*buf, *size);
+    }
+}
+
+/* read a special token, whose key is never coded; returns 0,
+ * DS_NOTFOUND, or the error of the database */
+static int get_special(dsh_t *dsh, const char *name, dsv_t *val)
+{
+    word_t *token = word_news(name);
+    dbv_t ex_key;
+    dbv_t ex_data;
+    uint32_t cv[5];
+    int ret;
+
+    struct_init(ex_key);
+    struct_init(ex_data);
+    ex_key.data = token->u.text;
+    ex_key.leng = token->leng;
+    ex_data.data = cv;
+    ex_data.leng = sizeof(cv);
+
+    ret = db_get_dbvalue(dsh->dbh, &ex_key, &ex_data);
+    if (ret == 0)
+	convert_external_to_internal(dsh, (dbv_const_t *)&ex_data, val);
+    word_free(token);
+
+    return ret;
+}
+
+/* find out if the wordlist's keys are coded, inside the transaction if
+ * there is one, and refuse a wordlist of a newer format; returns 0 or
+ * the error of the database */
+static int check_key_coding(dsh_t *dsh)
+{
+    dsv_t val;
+    int ret;
+
+    if (dsh->key_coding >= 0)
+	return 0;
+
+    ret = get_special(dsh, WORDLIST_VERSION, &val);
+    if (ret == 0 && val.count[0] > NEWEST_VERSION) {
+	fprintf(stderr, "Wordlist '%s' has version %lu, this %s reads up to %lu.\n",
+		dsh->bfp->filepath, (unsigned long)val.count[0], progname,
+		(unsigned long)NEWEST_VERSION);
+	exit(EX_ERROR);
+    }
+    if (ret != 0 && ret != DS_NOTFOUND)
+	return ret;
+
+    ret = get_special(dsh, KEY_ENCODING, &val);
+    switch (ret) {
+    case 0:
+	dsh->key_coding = (val.spamcount != 0);
+	return 0;
+    case DS_NOTFOUND:
+	dsh->key_coding = 0;
+	return 0;
+    default:
+	return ret;
+    }
+}
+
+/* the code of the tag at text[i], if a tag may start there, else 0 */
+static uint tag_code(const byte *text, uint leng, uint i)
+{
+    size_t c;
+
+    if (i != 0 && text[i-1] != '*')
+	return 0;
+
+    for (c = 1; c < KEY_TAGS; c += 1) {
+	size_t len = strlen(key_tags[c]);
+	if (leng - i >= len && memcmp(text + i, key_tags[c], len) == 0)
+	    return (uint) c;
+    }
+
+    return 0;
+}
+
+/* whether a word is stored verbatim, after KEY_ESCAPE */
+static bool key_escaped(const word_t *word)
+{
+    uint i;
+
+    for (i = 0; i < word->leng; i += 1) {
+	if (word->u.text[i] != 0 && word->u.text[i] <= KEY_ESCAPE)
+	    return true;
+    }
+
+    return false;
+}
+
+/* the bytes of a coded key, one at a time */
+typedef struct {
+    const word_t *word;
+    uint pos;
+    bool verbatim;		/* escaped, its tags are not coded */
+    bool escape;		/* KEY_ESCAPE comes next */
+} key_iter_t;
+
+static void key_first(key_iter_t *it, const word_t *word)
+{
+    it->word = word;
+    it->pos = 0;
+    it->verbatim = it->escape = key_escaped(word);
+}
+
+static int key_next(key_iter_t *it)
+{
+    const byte *text = it->word->u.text;
+    uint leng = it->word->leng;
+    uint c;
+
+    if (it->escape) {
+	it->escape = false;
+	return KEY_ESCAPE;
+    }
+    if (it->pos >= leng)
+	return -1;
+
+    c = it->verbatim ? 0 : tag_code(text, leng, it->pos);
+    if (c != 0) {
+	it->pos += strlen(key_tags[c]);
+	return (int) c;
+    }
+
+    return text[it->pos++];
+}
+
+int ds_coded_key_cmp(const word_t *w1, const word_t *w2)
+{
+    key_iter_t i1, i2;
+    int b1, b2;
+
+    key_first(&i1, w1);
+    key_first(&i2, w2);
+
+    do {
+	b1 = key_next(&i1);
+	b2 = key_next(&i2);
+    } while (b1 == b2 && b1 >= 0);
+
+    return (b1 == b2) ? 0 : (b1 < b2) ? -1 : 1;
+}
+
+bool ds_keys_coded(void *vhandle)
+{
+    dsh_t *dsh = (dsh_t *)vhandle;
+
+    return check_key_coding(dsh) == 0 && dsh->key_coding == 1;
+}
+
+/* the key under which \a word is stored; returns 0 or the error of
+ * check_key_coding() */
+static int encode_key(dsh_t *dsh, const word_t *word, dbv_t *ex_key)
+{
+    const byte *text = word->u.text;
+    uint leng = word->leng;
+    byte *out;
+    uint i, o = 0;
+    int ret = check_key_coding(dsh);
+
+    if (ret != 0)
+	return ret;
+
+    if (dsh->key_coding == 0) {
+	ex_key->data = word->u.text;
+	ex_key->leng = word->leng;
+	return 0;
+    }
+
+    grow_buffer(&dsh->key_enc, &dsh->key_enc_size, leng + 1);
+    out = dsh->key_enc;
+
+    if (key_escaped(word)) {
+	out[o++] = KEY_ESCAPE;
+	memcpy(out + o, text, leng);
+	o += leng;
+    } else {
+	i = 0;
+	while (i < leng) {
+	    uint c = tag_code(text, leng, i);
+	    if (c != 0) {
+		out[o++] = (byte) c;
+		i += strlen(key_tags[c]);
+		continue;
+	    }
+	    out[o++] = text[i++];
+	}
+    }
+
+    ex_key->data = out;
+    ex_key->leng = o;
+    return 0;
+}
+
+/* the token of the key \a ex_key, valid until the next call */
+static void decode_key(dsh_t *dsh, const dbv_t *ex_key, word_t *word)
+{
+    const byte *in = (const byte *)ex_key->data;
+    uint leng = ex_key->leng;
+    uint i, o = 0;
+
+    if (check_key_coding(dsh) != 0 || dsh->key_coding == 0 || leng == 0) {
+	word->u.text = (byte *)ex_key->data;
+	word->leng = leng;
+	return;
+    }
+
+    if (in[0] == KEY_ESCAPE) {
+	word->u.text = (byte *)ex_key->data + 1;
+	word->leng = leng - 1;
+	return;
+    }
+
+    grow_buffer(&dsh->key_dec, &dsh->key_dec_size, leng * MAX_TAG_LEN);
+    for (i = 0; i < leng; i += 1) {
+	if (in[i] != 0 && in[i] < KEY_TAGS) {
+	    size_t len = strlen(key_tags[in[i]]);
+	    memcpy(dsh->key_dec + o, key_tags[in[i]], len);
+	    o += len;
+	} else
+	    dsh->key_dec[o++] = in[i];
+    }
+
+    word->u.text = dsh->key_dec;
+    word->leng = o;
+}
+
 dsh_t *dsh_init(void *dbh)		/* database handle from db_open() */
 {
     dsh_t *val = (dsh_t *)xmalloc(sizeof(*val));
     val->dbh = dbh;
     val->is_swapped = db_is_swapped(dbh);
+    val->dbe = NULL;
+    val->bfp = NULL;
+    val->bloom = NULL;
+    val->writable = false;
+    val->key_coding = -1;
+    val->key_enc = NULL;
+    val->key_enc_size = 0;
+    val->key_dec = NULL;
+    val->key_dec_size = 0;
     return val;
 }
 
 void dsh_free(void *vhandle)
 {
     dsh_t *dsh = (dsh_t *)vhandle;
+    bloom_close(dsh->bloom);
+    xfree(dsh->key_enc);
+    xfree(dsh->key_dec);
     xfree(dsh);
     return;
 }
@@ -158,6 +440,14 @@ void *ds_open(void *dbe, bfpath *bfp, dbmode_t open_mode)
 	return NULL;
 
     dsh = dsh_init(v);
+    dsh->dbe = dbe;
+    dsh->bfp = bfp;
+    dsh->writable = (open_mode & DS_WRITE) != 0;
+
+    /* writers keep the filter complete, readers only use it with
+     * negative_cache */
+    if (dsh->writable || negative_cache)
+	dsh->bloom = bloom_open(bfp, dsh->writable);
 
     if (db_created(v) && ! (open_mode & DS_LOAD) && (open_mode & DS_WRITE)) {
 	if (DST_OK != ds_txn_begin(dsh))
@@ -173,6 +463,26 @@ void *ds_open(void *dbe, bfpath *bfp, dbmode_t open_mode)
 	    exit(EX_ERROR);
     }
 
+    /* the keys of a wordlist are coded from its creation on, if at all;
+     * its version keeps programs that don't know the coding out */
+    if (db_created(v) && (open_mode & DS_WRITE) && key_encoding) {
+	dsv_t val, vers;
+	word_t *token = word_news(KEY_ENCODING);
+
+	memset(&val, 0, sizeof(val));
+	val.spamcount = 1;
+	memset(&vers, 0, sizeof(vers));
+	vers.count[0] = KEY_CODING;
+	dsh->key_coding = 0;	/* the token itself is never coded */
+	if (DST_OK != ds_txn_begin(dsh) ||
+	    ds_write(dsh, token, &val) != 0 ||
+	    ds_set_wordlist_version(dsh, &vers) != 0 ||
+	    DST_OK != ds_txn_commit(dsh))
+	    exit(EX_ERROR);
+	dsh->key_coding = 1;
+	word_free(token);
+    }
+
     return dsh;
 }
 
@@ -180,6 +490,9 @@ void ds_close(/*@only@*/ void *vhandle)
 {
     dsh_t *dsh = (dsh_t *)vhandle;
     db_close(dsh->dbh);
+    bloom_close(dsh->bloom);
+    xfree(dsh->key_enc);
+    xfree(dsh->key_dec);
     xfree(dsh);
 }
 
@@ -195,23 +508,31 @@ int ds_read(void *vhandle, const word_t *word, /*@out@*/ dsv_t *val)
     dsh_t *dsh = (dsh_t *)vhandle;
     dbv_t ex_key;
     dbv_t ex_data;
-    uint32_t cv[3];
+    uint32_t cv[5];
 
     struct_init(ex_key);
     struct_init(ex_data);
 
-    ex_key.data = word->u.text;
-    ex_key.leng = word->leng;
-
     memset(val, 0, sizeof(*val));
 
+    if (negative_cache && dsh->bloom != NULL && !bloom_maybe(dsh->bloom, word)) {
+	PERFSTATS_COUNT(PC_FILTER_NEGATIVES, 1);
+	if (DEBUG_DATABASE(3)) {
+	    fprintf(dbgout, "ds_read: [%.*s] not in filter\n",
+		    CLAMP_INT_MAX(word->leng), (char *) word->u.text);
+	}
+	return 1;
+    }
+
     /* init ex_data inside loop since first db_get_value()
     ** call can change it and cause the second call to fail.
     */
     ex_data.data = cv;
     ex_data.leng = sizeof(cv);
 
-    ret = db_get_dbvalue(dsh->dbh, &ex_key, &ex_data);
+    ret = encode_key(dsh, word, &ex_key);
+    if (ret == 0)
+	ret = db_get_dbvalue(dsh->dbh, &ex_key, &ex_data);
 
     switch (ret) {
     case 0:
@@ -226,6 +547,8 @@ int ds_read(void *vhandle, const word_t *word, /*@out@*/ dsv_t *val)
 	return 0;
 
     case DS_NOTFOUND:
+	if (negative_cache && dsh->bloom != NULL)
+	    PERFSTATS_COUNT(PC_FILTER_FALSE_POS, 1);
 	if (DEBUG_DATABASE(3)) {
 	    fprintf(dbgout, "ds_read: [%.*s] not found\n", 
 		    CLAMP_INT_MAX(word->leng), (char *) word->u.text);
@@ -249,27 +572,32 @@ int ds_read(void *vhandle, const word_t *word, /*@out@*/ dsv_t *val)
     return ret;
 }
 
-int ds_write(void *vhandle, const word_t *word, dsv_t *val)
+static int ds_write_value(void *vhandle, const word_t *word, dsv_t *val, bool with_prob)
 {
     int ret = 0;
     dsh_t *dsh = (dsh_t *)vhandle;
     dbv_t ex_key;
     dbv_t ex_data;
-    uint32_t cv[3];
+    uint32_t cv[5];
 
     struct_init(ex_key);
     struct_init(ex_data);
 
-    ex_key.data = word->u.text;
-    ex_key.leng = word->leng;
+    ret = encode_key(dsh, word, &ex_key);
+    if (ret != 0)
+	return ret;
 
     ex_data.data = cv;
     ex_data.leng = sizeof(cv);
 
-    if (timestamp_tokens && today != 0)
+    if (timestamp_tokens && today != 0 && !with_prob)
 	val->date = today;
 
-    convert_internal_to_external(dsh, val, &ex_data);
+    convert_internal_to_external(dsh, val, &ex_data, with_prob);
+
+    /* a superset of the tokens, even if the transaction aborts */
+    if (dsh->bloom != NULL)
+	bloom_add(dsh->bloom, word);
 
     ret = db_set_dbvalue(dsh->dbh, &ex_key, &ex_data);
 
@@ -284,6 +612,16 @@ int ds_write(void *vhandle, const word_t *word, dsv_t *val)
     return ret;		/* 0 if ok */
 }
 
+int ds_write(void *vhandle, const word_t *word, dsv_t *val)
+{
+    return ds_write_value(vhandle, word, val, false);
+}
+
+int ds_write_prob(void *vhandle, const word_t *word, dsv_t *val)
+{
+    return ds_write_value(vhandle, word, val, true);
+}
+
 int ds_delete(void *vhandle, const word_t *word)
 {
     dsh_t *dsh = (dsh_t *)vhandle;
@@ -291,8 +629,9 @@ int ds_delete(void *vhandle, const word_t *word)
     dbv_t ex_key;
 
     struct_init(ex_key);
-    ex_key.data = word->u.text;
-    ex_key.leng = word->leng;
+    ret = encode_key(dsh, word, &ex_key);
+    if (ret != 0)
+	return ret;
 
     ret = db_delete(dsh->dbh, &ex_key);
 
@@ -301,6 +640,9 @@ int ds_delete(void *vhandle, const word_t *word)
 
 int ds_txn_begin(void *vhandle) {
     dsh_t *dsh = (dsh_t *)vhandle;
+    /* pick up a filter that bogoutil --build-filter (re)built */
+    if (dsh->bfp != NULL && (dsh->writable || negative_cache))
+	dsh->bloom = bloom_check(dsh->bloom, dsh->bfp, dsh->writable);
     if (dsm->dsm_begin == NULL)
 	return 0;
     else
@@ -339,8 +681,7 @@ static ex_t ds_hook(dbv_t *ex_key,
     ds_userdata_t *ds_data = (ds_userdata_t *)userdata;
     dsh_t *dsh = ds_data->dsh;
 
-    w_key.u.text = (byte *)ex_key->data;
-    w_key.leng = ex_key->leng;
+    decode_key(dsh, ex_key, &w_key);
 
     memset(&in_data, 0, sizeof(in_data));
     convert_external_to_internal(dsh, ex_data, &in_data);
@@ -364,6 +705,210 @@ ex_t ds_foreach(void *vhandle, ds_foreach_t *hook, void *userdata)
     return ret;
 }
 
+typedef struct {
+    ds_userdata_t ds;
+    uint	  left;		/* tokens to go in this chunk */
+    bool	  stopped;	/* chunk full before the end */
+    word_t	 *last;		/* last token visited */
+    ex_t	  ret;		/* return value of the hook */
+} ds_chunkdata_t;
+
+static ex_t ds_chunk_hook(dbv_t *ex_key,
+			  dbv_const_t *ex_data,
+			  void *userdata)
+{
+    ds_chunkdata_t *cd = (ds_chunkdata_t *)userdata;
+    word_t w_key;
+
+    if (cd->left == 0) {
+	cd->stopped = true;
+	return 1;
+    }
+    cd->left -= 1;
+
+    word_free(cd->last);
+    decode_key(cd->ds.dsh, ex_key, &w_key);
+    cd->last = word_dup(&w_key);
+
+    cd->ret = ds_hook(ex_key, ex_data, &cd->ds);
+
+    return cd->ret;
+}
+
+ex_t ds_foreach_chunk(void *vhandle, const word_t *after, uint limit,
+		      ds_foreach_t *hook, void *userdata, word_t **last)
+{
+    dsh_t *dsh = (dsh_t *)vhandle;
+    ex_t ret;
+    dbv_t start;
+    ds_chunkdata_t cd;
+
+    cd.ds.hook = hook;
+    cd.ds.dsh  = dsh;
+    cd.ds.data = userdata;
+    cd.left    = limit;
+    cd.stopped = false;
+    cd.last    = NULL;
+    cd.ret     = EX_OK;
+
+    struct_init(start);
+    if (after != NULL) {
+	/* a copy, the hook may code other keys */
+	if (encode_key(dsh, after, &start) != 0)
+	    return EX_ERROR;
+	start.data = memcpy(xmalloc(start.leng), start.data, start.leng);
+    }
+
+    ret = db_foreach_from(dsh->dbh, after != NULL ? &start : NULL,
+			  ds_chunk_hook, &cd);
+    xfree(start.data);
+
+    /* some backends report a stopped traversal as an error */
+    if (cd.ret != EX_OK)
+	ret = cd.ret;
+    else if (cd.stopped)
+	ret = EX_OK;
+
+    if (ret != EX_OK || !cd.stopped) {
+	word_free(cd.last);
+	cd.last = NULL;
+    }
+    *last = cd.last;
+
+    return ret;
+}
+
+typedef struct {
+    ds_userdata_t ds;
+    const dbv_t	 *lower;	/* NULL for the first range */
+    const dbv_t	 *upper;	/* NULL for the last range */
+    bool	  stopped;	/* reached upper */
+    ex_t	  ret;
+} ds_part_t;
+
+static int dbv_cmp(const dbv_t *a, const dbv_t *b)
+{
+    int r = memcmp(a->data, b->data, min(a->leng, b->leng));
+    if (r != 0)
+	return r;
+    return (a->leng > b->leng) - (a->leng < b->leng);
+}
+
+/* a range holds the keys after lower, up to and including upper */
+static ex_t ds_part_hook(dbv_t *ex_key,
+			 dbv_const_t *ex_data,
+			 void *userdata)
+{
+    ds_part_t *part = (ds_part_t *)userdata;
+
+    if (part->upper != NULL && dbv_cmp(ex_key, part->upper) > 0) {
+	part->stopped = true;
+	return 1;
+    }
+
+    part->ret = ds_hook(ex_key, ex_data, &part->ds);
+
+    return part->ret;
+}
+
+static void *ds_part_scan(void *vpart)
+{
+    ds_part_t *part = (ds_part_t *)vpart;
+    ex_t ret = db_foreach_from(part->ds.dsh->dbh, part->lower, ds_part_hook, part);
+
+    /* some backends report a stopped traversal as an error */
+    if (part->ret == EX_OK && !part->stopped)
+	part->ret = ret;
+
+    return NULL;
+}
+
+ex_t ds_foreach_parallel(void *vhandle, uint parts,
+			 ds_foreach_t *hook, void *userdata, size_t size,
+			 ds_merge_t *merge)
+{
+    dsh_t *dsh = (dsh_t *)vhandle;
+    ex_t ret = EX_OK;
+    dbv_t *bounds;
+    ds_part_t *part;
+    uint i, n = 1;
+#ifdef	HAVE_PTHREAD_CREATE
+    pthread_t *threads;
+    bool *started;
+#endif
+
+    if (parts <= 1 || dsh->dbe == NULL)
+	return ds_foreach(vhandle, hook, userdata);
+
+    bounds = (dbv_t *)xcalloc(parts - 1, sizeof(dbv_t));
+    n = db_split_keys(dsh->dbh, parts, bounds);
+    if (n <= 1) {
+	xfree(bounds);
+	return ds_foreach(vhandle, hook, userdata);
+    }
+
+    if (DEBUG_DATABASE(1))
+	fprintf(dbgout, "ds_foreach_parallel: %u key ranges\n", n);
+
+    /* the readers are opened here, as opening is not thread safe */
+    part = (ds_part_t *)xcalloc(n, sizeof(ds_part_t));
+    for (i = 0; i < n; i += 1) {
+	part[i].ds.hook = hook;
+	part[i].ds.data = xmalloc(size);
+	memcpy(part[i].ds.data, userdata, size);
+	part[i].lower = (i > 0) ? &bounds[i-1] : NULL;
+	part[i].upper = (i < n-1) ? &bounds[i] : NULL;
+	part[i].ret = EX_OK;
+	part[i].ds.dsh = (dsh_t *)ds_open(dsh->dbe, dsh->bfp, DS_READ);
+	if (part[i].ds.dsh == NULL)
+	    ret = EX_ERROR;
+	else if (DST_OK != ds_txn_begin(part[i].ds.dsh)) {
+	    ds_close(part[i].ds.dsh);
+	    part[i].ds.dsh = NULL;
+	    ret = EX_ERROR;
+	}
+    }
+
+    if (ret == EX_OK) {
+#ifdef	HAVE_PTHREAD_CREATE
+	threads = (pthread_t *)xcalloc(n, sizeof(pthread_t));
+	started = (bool *)xcalloc(n, sizeof(bool));
+	for (i = 0; i < n; i += 1)
+	    started[i] = pthread_create(&threads[i], NULL, ds_part_scan, &part[i]) == 0;
+	for (i = 0; i < n; i += 1) {
+	    if (started[i])
+		pthread_join(threads[i], NULL);
+	    else
+		(void)ds_part_scan(&part[i]);
+	}
+	xfree(started);
+	xfree(threads);
+#else
+	for (i = 0; i < n; i += 1)
+	    (void)ds_part_scan(&part[i]);
+#endif
+    }
+
+    /* merge all ranges, so that merge can free what the hook allocated */
+    for (i = 0; i < n; i += 1) {
+	if (part[i].ds.dsh != NULL) {
+	    (void)ds_txn_commit(part[i].ds.dsh);
+	    ds_close(part[i].ds.dsh);
+	}
+	if (ret == EX_OK)
+	    ret = part[i].ret;
+	(*merge)(userdata, part[i].ds.data);
+	xfree(part[i].ds.data);
+    }
+    xfree(part);
+
+    for (i = 0; i < n - 1; i += 1)
+	xfree(bounds[i].data);
+    xfree(bounds);
+
+    return ret;
+}
+
 /* Wrapper for ds_foreach that opens and closes file */
 
 ex_t ds_oper(void *env, bfpath *bfp, dbmode_t open_mode, 
@@ -29,6 +29,7 @@ Matthias Andree <matthias.andree@gmx.de> 2003
 #include <db.h>
 #endif
 
+#include "bloom.h"
 #include "paths.h"
 #include "word.h"
 
@@ -39,6 +40,11 @@ extern YYYYMMDD today;		/* date as YYYYMMDD */
  */
 #define MSG_COUNT ".MSG_COUNT"
 
+/** Name of the special token that marks a wordlist whose keys are
+ * stored with their tag prefixes coded, see key_encoding.
+ */
+#define KEY_ENCODING ".KEY_ENCODING"
+
 /** Datastore handle type
 ** - used to communicate between datastore layer and database layer
 ** - known to program layer as a void*
@@ -48,6 +54,20 @@ typedef struct {
     void   *dbh;
     /** tracks endianness */
     bool is_swapped;
+    /** environment and path from ds_open(), for ds_foreach_parallel() */
+    void   *dbe;
+    bfpath *bfp;
+    /** filter of the tokens, see bloom.c, NULL if none */
+    bloom_t *bloom;
+    /** opened for writing, the filter must learn new tokens */
+    bool    writable;
+    /** keys with coded prefixes: 1, verbatim: 0, not known yet: -1 */
+    int     key_coding;
+    /** buffers for coding and decoding keys */
+    byte   *key_enc;
+    size_t  key_enc_size;
+    byte   *key_dec;
+    size_t  key_dec_size;
 } dsh_t;
 
 /** Datastore value type, used to communicate between program layer and
@@ -58,6 +78,10 @@ typedef struct {
     u_int32_t count[IX_SIZE];
     /** time stamp */
     u_int32_t date;
+    /** generation of the precomputed probability, 0 if none */
+    u_int32_t prob_gen;
+    /** precomputed probability, see prob_quantize() */
+    u_int32_t prob;
 } dsv_t;
 
 #define	spamcount count[IX_SPAM]
@@ -170,6 +194,39 @@ extern ex_t ds_foreach(void *vhandle	  /** data store handle */,
 		       void *userdata	  /** opaque data that is passed to the callback function
 					      unaltered */);
 
+/** Like ds_foreach, but visits the records in key order, starting
+ * after the token \p after (with the first record if NULL), and at most
+ * \p limit of them.  If the limit stops the traversal, \p *last gets
+ * a copy of the last token visited, from where the next chunk starts;
+ * at the end of the data base it gets NULL.
+ */
+extern ex_t ds_foreach_chunk(void *vhandle, const word_t *after, uint limit,
+			     ds_foreach_t *hook, void *userdata, word_t **last);
+
+/** \return true if the keys of the wordlist \p vhandle are coded (see
+ * key_encoding); its key order is then that of ds_coded_key_cmp()
+ * rather than that of word_cmp(). */
+extern bool ds_keys_coded(void *vhandle);
+
+/** Compare two tokens by their coded keys. */
+extern int ds_coded_key_cmp(const word_t *w1, const word_t *w2);
+
+/** Type of the function that ds_foreach_parallel calls to fold the
+ * result of one key range, \p part, into \p userdata. */
+typedef void ds_merge_t(void *userdata, void *part);
+
+/** Like ds_foreach, but splits the data base into up to \p parts key
+ * ranges that are scanned concurrently, each by a reader of its own.
+ * The hook of each range works on a copy of the \p size bytes at
+ * \p userdata, so totals in it should start at zero, and must leave
+ * other state alone; \p merge then folds the copies into \p userdata,
+ * in key order of the ranges.  With one
+ * range, or if the backend can't split its keys, this is ds_foreach.
+ */
+extern ex_t ds_foreach_parallel(void *vhandle, uint parts,
+				ds_foreach_t *hook, void *userdata, size_t size,
+				ds_merge_t *merge);
+
 /** Wrapper for ds_foreach that opens and closes file */
 extern ex_t ds_oper(void *dbenv,	/**< parent environment */
 		    bfpath *bfp,	/**< path to database file */
@@ -223,6 +280,11 @@ extern int  ds_delete(void *vhandle, const word_t *word);
 /** Set the value associated with a given word in a list. Front end. */
 extern int  ds_write (void *vhandle, const word_t *word, dsv_t *val);
 
+/** Set the value associated with a given word in a list, keeping the
+ * precomputed probability of \p val.  ds_write() drops it, so that any
+ * update of the counts invalidates it. */
+extern int  ds_write_prob(void *vhandle, const word_t *word, dsv_t *val);
+
 /** Set the value associated with a given word in a list. Implementation. */
 extern int ds_set_dbvalue(void *vhandle, const dbv_t *token, dbv_t *val);
 
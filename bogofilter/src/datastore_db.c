@@ -985,7 +985,18 @@ void db_flush(void *vhandle)
     dsm->dsm_log_flush(handle->dbenv->dbe);
 }
 
+#if DB_AT_LEAST(4,6)
+#define DBC_GET(dbcp, key, data, flags) (dbcp)->get(dbcp, key, data, flags)
+#else
+#define DBC_GET(dbcp, key, data, flags) (dbcp)->c_get(dbcp, key, data, flags)
+#endif
+
 ex_t db_foreach(void *vhandle, db_foreach_t hook, void *userdata)
+{
+    return db_foreach_from(vhandle, NULL, hook, userdata);
+}
+
+ex_t db_foreach_from(void *vhandle, const dbv_t *after, db_foreach_t hook, void *userdata)
 {
     dbh_t *handle = (dbh_t *)vhandle;
     DB *dbp = handle->dbp;
@@ -1012,15 +1023,19 @@ ex_t db_foreach(void *vhandle, db_foreach_t hook, void *userdata)
 	return EX_ERROR;
     }
 
-#if DB_AT_LEAST(4,6)
-    for (rv =  dbcp->get(dbcp, &key, &data, DB_FIRST);
-	 rv == 0;
-	 rv =  dbcp->get(dbcp, &key, &data, DB_NEXT))
-#else
-    for (rv =  dbcp->c_get(dbcp, &key, &data, DB_FIRST);
-	 rv == 0;
-	 rv =  dbcp->c_get(dbcp, &key, &data, DB_NEXT))
-#endif
+    if (after == NULL)
+	rv = DBC_GET(dbcp, &key, &data, DB_FIRST);
+    else {
+	/* DB_SET_RANGE finds the smallest key >= after */
+	key.data = after->data;
+	key.size = after->leng;
+	rv = DBC_GET(dbcp, &key, &data, DB_SET_RANGE);
+	if (rv == 0 && key.size == after->leng
+	    && memcmp(key.data, after->data, key.size) == 0)
+	    rv = DBC_GET(dbcp, &key, &data, DB_NEXT);
+    }
+
+    for (; rv == 0; rv = DBC_GET(dbcp, &key, &data, DB_NEXT))
     {
 	int rc;
 
@@ -1069,6 +1084,16 @@ ex_t db_foreach(void *vhandle, db_foreach_t hook, void *userdata)
     return eflag ? EX_ERROR : ret;
 }
 
+/* The environment is not opened with DB_THREAD, so its handles
+ * can't be used by several threads. */
+uint db_split_keys(void *vhandle, uint parts, dbv_t *bounds)
+{
+    (void)vhandle;
+    (void)parts;
+    (void)bounds;
+    return 1;
+}
+
 const char *db_str_err(int e) {
     return db_strerror(e);
 }
@@ -72,6 +72,16 @@ typedef ex_t (*db_foreach_t)(dbv_t *token, dbv_const_t *data, void *userdata);
 /** Iterate over all elements in data base and call \p hook for each item.
  * \p userdata is passed through to the hook function unaltered. */
 ex_t db_foreach(void *handle, db_foreach_t hook, void *userdata);
+/** Like db_foreach, but visits the elements in key order (bytewise),
+ * starting with the first key greater than \p after, or with the
+ * first key if \p after is NULL.  Lets a traversal be resumed. */
+ex_t db_foreach_from(void *handle, const dbv_t *after, db_foreach_t hook, void *userdata);
+
+/** Choose up to \p parts - 1 keys that split the data base into key
+ * ranges of about equal size, and store copies of them (xmalloc'ed) in
+ * \p bounds, in ascending order.  Returns the number of ranges, 1 if
+ * the backend can't be read by concurrent readers. */
+uint db_split_keys(void *handle, uint parts, dbv_t *bounds);
 
 /** Returns error string associated with \a code. */
 const char *db_str_err(int code);
@@ -235,6 +235,7 @@ static int dbx_begin(void *vhandle)
 {
     DB_TXN *t;
     int ret;
+    u_int32_t flags = 0;
 
     dbh_t *dbh = (dbh_t *)vhandle;
     dbe_t *env = dbh->dbenv;
@@ -246,7 +247,14 @@ static int dbx_begin(void *vhandle)
     assert(env);
     assert(env->dbe);
 
-    ret = BF_TXN_BEGIN(env->dbe, NULL, &t, 0);
+#ifdef	DB_TXN_SNAPSHOT
+    /* read the last committed pages without taking read locks, so
+     * that writers do not wait for us, nor we for them */
+    if (db_snapshot_reads && dbh->open_mode == DS_READ)
+	flags |= DB_TXN_SNAPSHOT;
+#endif
+
+    ret = BF_TXN_BEGIN(env->dbe, NULL, &t, flags);
     if (ret) {
 	print_error(__FILE__, __LINE__, "DB_ENV->txn_begin(%p), err: %d, %s",
 		(void *)env->dbe, ret, db_strerror(ret));
@@ -498,6 +506,16 @@ static dbe_t *dbe_xinit(dbe_t *env, bfpath *bfp, u_int32_t flags)
 
     dbe_config(env);
 
+#ifdef	DB_MULTIVERSION
+    /* copy-on-write pages, for the snapshot transactions of readers */
+    if (db_snapshot_reads &&
+	    (ret = env->dbe->set_flags(env->dbe, DB_MULTIVERSION, 1)) != 0) {
+	print_error(__FILE__, __LINE__, "DB_ENV->set_flags(DB_MULTIVERSION), err: %d, %s",
+		ret, db_strerror(ret));
+	exit(EX_ERROR);
+    }
+#endif
+
     flags |= DB_CREATE | dbenv_defflags;
 
     ret = env->dbe->open(env->dbe, bfp->dirname, flags, DS_MODE);
@@ -267,6 +267,11 @@ void db_flush(void *vhandle)
 }
 
 ex_t db_foreach(void *vhandle, db_foreach_t hook, void *userdata)
+{
+    return db_foreach_from(vhandle, NULL, hook, userdata);
+}
+
+ex_t db_foreach_from(void *vhandle, const dbv_t *after, db_foreach_t hook, void *userdata)
 {
     dbh_t *handle = (dbh_t *)vhandle;
     KCCUR *cursor;
@@ -279,11 +284,30 @@ ex_t db_foreach(void *vhandle, db_foreach_t hook, void *userdata)
     const char *data;
 
     cursor = kcdbcursor(handle->dbp);
-    if (!kccurjump(cursor)) {
-        print_error(__FILE__, __LINE__, "kccurjump(), err: %d, %s",
-                    kcdbecode(handle->dbp), kcdbemsg(handle->dbp));
-        retval = EX_ERROR;
-        goto done;
+    if (after == NULL) {
+        if (!kccurjump(cursor)) {
+            print_error(__FILE__, __LINE__, "kccurjump(), err: %d, %s",
+                        kcdbecode(handle->dbp), kcdbemsg(handle->dbp));
+            retval = EX_ERROR;
+            goto done;
+        }
+    } else {
+        /* kccurjumpkey() finds the smallest key >= after */
+        if (!kccurjumpkey(cursor, after->data, after->leng)) {
+            if (kcdbecode(handle->dbp) != KCENOREC) {
+                print_error(__FILE__, __LINE__, "kccurjumpkey(), err: %d, %s",
+                            kcdbecode(handle->dbp), kcdbemsg(handle->dbp));
+                retval = EX_ERROR;
+            }
+            goto done;
+        }
+        if ((key = kccurgetkey(cursor, &ksiz, false)) != NULL) {
+            bool same = ksiz == after->leng
+                && memcmp(key, after->data, ksiz) == 0;
+            kcfree(key);
+            if (same)
+                kccurstep(cursor);
+        }
     }
 
     while ((key = kccurget(cursor, &ksiz, &data, &dsiz, true)) != NULL) {
@@ -309,6 +333,16 @@ done:
     return retval;
 }
 
+/* Not done for Kyoto Cabinet yet; ds_foreach_parallel() then falls
+ * back to a single scan. */
+uint db_split_keys(void *vhandle, uint parts, dbv_t *bounds)
+{
+    UNUSED(vhandle);
+    UNUSED(parts);
+    UNUSED(bounds);
+    return 1;
+}
+
 const char *db_str_err(int e)
 {
     UNUSED(e);
@@ -966,6 +966,12 @@ db_flush(void *vhandle){
 
 ex_t
 db_foreach(void *vhandle, db_foreach_t hook, void *userdata){
+    return db_foreach_from(vhandle, NULL, hook, userdata);
+}
+
+ex_t
+db_foreach_from(void *vhandle, dbv_t const *after, db_foreach_t hook,
+        void *userdata){
     dbv_t dbv_key;
     dbv_const_t dbv_val;
     char *buf;
@@ -993,12 +999,22 @@ db_foreach(void *vhandle, db_foreach_t hook, void *userdata){
     }
 
     buf = NULL;
-    for(cursor_op = MDB_FIRST;; cursor_op = MDB_NEXT){
+    for(cursor_op = (after == NULL ? MDB_FIRST : MDB_SET_RANGE);;
+            cursor_op = MDB_NEXT){
         size_t i;
         int e;
         MDB_val key, val;
 
+        if(cursor_op == MDB_SET_RANGE){
+            key.mv_size = after->leng;
+            key.mv_data = after->data;
+        }
         e = mdb_cursor_get(fecp, &key, &val, cursor_op);
+        /* MDB_SET_RANGE finds the smallest key >= after */
+        if(e == MDB_SUCCESS && cursor_op == MDB_SET_RANGE &&
+                key.mv_size == after->leng &&
+                !memcmp(key.mv_data, after->data, key.mv_size))
+            e = mdb_cursor_get(fecp, &key, &val, MDB_NEXT);
         if(e != MDB_SUCCESS){
             if(e != MDB_NOTFOUND){
                 print_error(__FILE__, __LINE__, "LMDB[%ld]: db_foreach(): "
@@ -1036,6 +1052,15 @@ db_version_str(void){
     return MDB_VERSION_STRING;
 }
 
+/* Read transactions are bound to their thread (no MDB_NOTLS). */
+uint
+db_split_keys(void *vhandle, uint parts, dbv_t *bounds){
+    UNUSED(vhandle);
+    UNUSED(parts);
+    UNUSED(bounds);
+    return 1;
+}
+
 char const *
 db_str_err(int e){
     return mdb_strerror(e);
@@ -272,6 +272,11 @@ void db_flush(void *vhandle)
 
 
 ex_t db_foreach(void *vhandle, db_foreach_t hook, void *userdata)
+{
+    return db_foreach_from(vhandle, NULL, hook, userdata);
+}
+
+ex_t db_foreach_from(void *vhandle, const dbv_t *after, db_foreach_t hook, void *userdata)
 {
     int ret = 0;
 
@@ -283,7 +288,19 @@ ex_t db_foreach(void *vhandle, db_foreach_t hook, void *userdata)
     int ksiz, dsiz;
     char *key, *data;
 
-    ret = vlcurfirst(dbp);
+    if (after == NULL)
+	ret = vlcurfirst(dbp);
+    else {
+	/* VL_JFORWARD finds the smallest key >= after */
+	ret = vlcurjump(dbp, after->data, after->leng, VL_JFORWARD);
+	if (!ret && dpecode == DP_ENOITEM)
+	    return EX_OK;
+	if (ret && (key = vlcurkey(dbp, &ksiz)) != NULL) {
+	    if (cmpkey(key, ksiz, after->data, after->leng) == 0)
+		vlcurnext(dbp);
+	    free(key);
+	}
+    }
     if (ret) {
 	while ((key = vlcurkey(dbp, &ksiz))) {
 	    data = vlcurval(dbp, &dsiz);
@@ -311,7 +328,8 @@ ex_t db_foreach(void *vhandle, db_foreach_t hook, void *userdata)
 	    vlcurnext(dbp);
 	}
     } else {
-	print_error(__FILE__, __LINE__, "(qdbm) vlcurfirst err: %d, %s",
+	print_error(__FILE__, __LINE__, "(qdbm) %s err: %d, %s",
+		    after == NULL ? "vlcurfirst" : "vlcurjump",
 		    dpecode, dperrmsg(dpecode));
 	exit(EX_ERROR);
     }
@@ -319,6 +337,15 @@ ex_t db_foreach(void *vhandle, db_foreach_t hook, void *userdata)
     return EX_OK;
 }
 
+/* QDBM handles can't be used by several threads. */
+uint db_split_keys(void *vhandle, uint parts, dbv_t *bounds)
+{
+    (void)vhandle;
+    (void)parts;
+    (void)bounds;
+    return 1;
+}
+
 const char *db_str_err(int e)
 {
     return dperrmsg(e);
@@ -181,6 +181,7 @@ static void db_trace(void *userdata /** unused */,
  */
 static int db_loop(sqlite3 *db,	/**< SQLite3 database handle */
 	const char *cmd,	/**< SQL command to obtain data */
+	const dbv_t *arg,	/**< if non-NULL, bound to the first parameter */
 	db_foreach_t hook,	/**< if non-NULL, called for each value */
 	void *userdata		/**  this is passed to the \a hook */
 	) {
@@ -200,6 +201,8 @@ static int db_loop(sqlite3 *db,	/**< SQLite3 database handle */
 	sqlite3_finalize(stmt);
 	return rc;
     }
+    if (arg != NULL)
+	sqlite3_bind_blob(stmt, 1, arg->data, arg->leng, SQLITE_STATIC);
     loop = true;
     while (loop) {
 	rc = sqlite3_step(stmt);
@@ -249,7 +252,7 @@ static int busyhandler(void *dummy, int count)
 {
     (void)dummy;
     (void)count;
-    rand_sleep(1000, 1000000);
+    lock_sleep(1000, 1000000);
     return 1;
 }
 
@@ -313,6 +316,14 @@ void *db_open(void *dummyenv, bfpath *bfp, dbmode_t mode)
 	goto barf;
     }
 
+    /* WAL mode is stored in the database file, so processes opening it
+     * later, readers included, use it too.  Readers then see the last
+     * commit before their transaction began and no longer block
+     * writers, nor wait for them. */
+    if (mode != DS_READ && db_snapshot_reads) {
+	if (sqlexec(dbh->db, "PRAGMA journal_mode=WAL;")) goto barf;
+    }
+
     /* check/set endianness marker and create table if needed */
     if (mode != DS_READ) {
 	/* using IMMEDIATE or DEFERRED here locks up in t.lock3
@@ -331,7 +342,7 @@ void *db_open(void *dummyenv, bfpath *bfp, dbmode_t mode)
 	 */
 	rc = db_loop(dbh->db, "SELECT name FROM sqlite_master "
 		"WHERE type='table' AND name='bogofilter';",
-		NULL, NULL);
+		NULL, NULL, NULL);
 	switch (rc) {
 	    case 0:
 		if (sqlexec(dbh->db, "COMMIT;")) goto barf;
@@ -481,7 +492,10 @@ static int sql_fastpath(
 
     while (1) {
 	rc = sqlite3_step(stmt);
-	switch (rc) {
+	/* extended result codes are on: in WAL mode, a transaction that
+	 * read an older snapshot gets SQLITE_BUSY_SNAPSHOT when it tries
+	 * to write, and must be restarted like on SQLITE_BUSY */
+	switch (rc & 0xff) {
 	    case SQLITE_ROW:	/* this is the only branch that loops */
 		if (val) {
 		    int len = min(INT_MAX, val->leng);
@@ -538,7 +552,85 @@ int db_get_dbvalue(void *vhandle, const dbv_t* token, /*@out@*/ dbv_t *val) {
 ex_t db_foreach(void *vhandle, db_foreach_t hook, void *userdata) {
     dbh_t *dbh = (dbh_t *)vhandle;
     const char *cmd = "SELECT key, value FROM bogofilter;";
-    return db_loop(dbh->db, cmd, hook, userdata) == 0 ? EX_OK : EX_ERROR;
+    return db_loop(dbh->db, cmd, NULL, hook, userdata) == 0 ? EX_OK : EX_ERROR;
+}
+
+/** Keys sampled per key range by db_split_keys(). */
+#define	SPLIT_SAMPLES	32
+/** Smaller tables are not worth splitting. */
+#define	SPLIT_MIN_ROWS	4096
+
+static int dbv_compare(const void *pv1, const void *pv2) {
+    const dbv_t *a = (const dbv_t *)pv1;
+    const dbv_t *b = (const dbv_t *)pv2;
+    int r = memcmp(a->data, b->data, min(a->leng, b->leng));
+    if (r != 0)
+	return r;
+    return (a->leng > b->leng) - (a->leng < b->leng);
+}
+
+/* The rowids follow the order of insertion, not that of the keys, so
+ * the keys of evenly spaced rowids make a fair sample of the key space.
+ * Finding each is a lookup in the rowid B-tree. */
+uint db_split_keys(void *vhandle, uint parts, dbv_t *bounds) {
+    dbh_t *dbh = (dbh_t *)vhandle;
+    sqlite3_stmt *stmt;
+    sqlite3_int64 maxid = 0;
+    uint nsample = parts * SPLIT_SAMPLES;
+    uint got = 0, n = 0, i;
+    dbv_t *sample;
+
+    stmt = sqlprep(dbh, "SELECT max(rowid) FROM bogofilter;", false);
+    if (stmt == NULL)
+	return 1;
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+	maxid = sqlite3_column_int64(stmt, 0);
+    sqlite3_finalize(stmt);
+    if (maxid < SPLIT_MIN_ROWS)
+	return 1;
+
+    stmt = sqlprep(dbh, "SELECT key FROM bogofilter WHERE rowid >= ? "
+		   "ORDER BY rowid LIMIT 1;", false);
+    if (stmt == NULL)
+	return 1;
+    sample = (dbv_t *)xcalloc(nsample, sizeof(dbv_t));
+    for (i = 0; i < nsample; i += 1) {
+	sqlite3_bind_int64(stmt, 1, 1 + maxid * i / nsample);
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+	    sample[got].leng = sqlite3_column_bytes(stmt, 0);
+	    sample[got].data = xmalloc(sample[got].leng + 1);
+	    memcpy(sample[got].data, sqlite3_column_blob(stmt, 0), sample[got].leng);
+	    got += 1;
+	}
+	sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+
+    qsort(sample, got, sizeof(dbv_t), dbv_compare);
+
+    /* the quantiles, unless equal to the previous one */
+    for (i = 1; got != 0 && i < parts; i += 1) {
+	dbv_t *s = &sample[i * got / parts];
+	if (n == 0 || dbv_compare(s, &bounds[n-1]) > 0) {
+	    bounds[n] = *s;
+	    s->data = NULL;
+	    n += 1;
+	}
+    }
+
+    for (i = 0; i < got; i += 1)
+	xfree(sample[i].data);
+    xfree(sample);
+
+    return n + 1;
+}
+
+ex_t db_foreach_from(void *vhandle, const dbv_t *after, db_foreach_t hook, void *userdata) {
+    dbh_t *dbh = (dbh_t *)vhandle;
+    const char *cmd = after == NULL
+	? "SELECT key, value FROM bogofilter ORDER BY key;"
+	: "SELECT key, value FROM bogofilter WHERE key > ? ORDER BY key;";
+    return db_loop(dbh->db, cmd, after, hook, userdata) == 0 ? EX_OK : EX_ERROR;
 }
 
 const char *db_str_err(int e) {
@@ -330,6 +330,11 @@ void db_flush(void *vhandle)
 
 
 ex_t db_foreach(void *vhandle, db_foreach_t hook, void *userdata)
+{
+    return db_foreach_from(vhandle, NULL, hook, userdata);
+}
+
+ex_t db_foreach_from(void *vhandle, const dbv_t *after, db_foreach_t hook, void *userdata)
 {
     int ret = 0;
 
@@ -343,10 +348,28 @@ ex_t db_foreach(void *vhandle, db_foreach_t hook, void *userdata)
     char *key, *data;
 
     cursor = tcbdbcurnew(dbp);
-    if (!tcbdbcurfirst(cursor)) {
-	print_error(__FILE__, __LINE__, "(tc) tcbdbcurfirst err: %d, %s",
-		    tcbdbecode(dbp), tcbdberrmsg(tcbdbecode(dbp)));
-	exit(EX_ERROR);
+    if (after == NULL) {
+	if (!tcbdbcurfirst(cursor)) {
+	    print_error(__FILE__, __LINE__, "(tc) tcbdbcurfirst err: %d, %s",
+			tcbdbecode(dbp), tcbdberrmsg(tcbdbecode(dbp)));
+	    exit(EX_ERROR);
+	}
+    } else {
+	/* tcbdbcurjump() finds the smallest key >= after */
+	if (!tcbdbcurjump(cursor, after->data, after->leng)) {
+	    int ecode = tcbdbecode(dbp);
+	    tcbdbcurdel(cursor);
+	    if (ecode == TCENOREC)
+		return EX_OK;
+	    print_error(__FILE__, __LINE__, "(tc) tcbdbcurjump err: %d, %s",
+			ecode, tcbdberrmsg(ecode));
+	    return EX_ERROR;
+	}
+	if ((key = (char *)tcbdbcurkey(cursor, &ksiz)) != NULL) {
+	    if (ksiz == (int)after->leng && memcmp(key, after->data, ksiz) == 0)
+		tcbdbcurnext(cursor);
+	    free(key);
+	}
     }
 
     while ((key = (char *)tcbdbcurkey(cursor, &ksiz))) {
@@ -379,6 +402,15 @@ ex_t db_foreach(void *vhandle, db_foreach_t hook, void *userdata)
     return EX_OK;
 }
 
+/* The database is opened without thread support (tcbdbsetmutex). */
+uint db_split_keys(void *vhandle, uint parts, dbv_t *bounds)
+{
+    UNUSED(vhandle);
+    UNUSED(parts);
+    UNUSED(bounds);
+    return 1;
+}
+
 const char *db_str_err(int e)
 {
     return tcbdberrmsg(e);
@@ -0,0 +1,465 @@
+/*****************************************************************************
+
+NAME:
+   delta.c -- export and apply binary deltas of the counts, for merging
+	      the wordlists of several nodes.
+
+   The token counts only ever change by registrations, which add to
+   them, so nodes can exchange just these changes.  "bogoutil
+   --export-delta" writes the local changes since the last export,
+   read from the replication log (see journal.c), and "bogoutil
+   --apply-delta" adds a delta from another node to the wordlist, in
+   key order and in one transaction.
+
+   Each wordlist has a node id, .REPL_NODE, and numbers its exports
+   in .REPL_GENERATION.  The generation of the last delta applied from
+   each node is kept in .REPL:<node id>, so applying a delta again
+   changes nothing, and a delta whose predecessors are not applied yet
+   is refused.
+
+   Format, numbers in network byte order:
+	"BFDELTA" 0x01
+	node id (8 bytes), generation (4 bytes), record count (4 bytes)
+   and then per token, in key order, as LEB128 varints:
+	length of the prefix shared with the previous token,
+	length and bytes of the rest,
+	zigzag coded changes of the spam and the good count
+   with .MSG_COUNT for the message counts.
+
+******************************************************************************/
+
+#include "common.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "datastore.h"
+#include "delta.h"
+#include "journal.h"
+#include "rand_sleep.h"
+#include "wordhash.h"
+#include "xmalloc.h"
+
+#define	DELTA_MAGIC	"BFDELTA\1"
+#define	MAGIC_SIZE	8
+#define	HEADER_SIZE	(MAGIC_SIZE + 8 + 4 + 4)
+
+typedef struct {
+    u_int64_t node;
+    u_int32_t generation;
+    u_int32_t count;
+} dhead_t;
+
+static void put_u32(byte *p, u_int32_t v)
+{
+    p[0] = (byte)(v >> 24);
+    p[1] = (byte)(v >> 16);
+    p[2] = (byte)(v >> 8);
+    p[3] = (byte)v;
+}
+
+static u_int32_t get_u32(const byte *p)
+{
+    return ((u_int32_t)p[0] << 24) | ((u_int32_t)p[1] << 16) |
+	((u_int32_t)p[2] << 8) | (u_int32_t)p[3];
+}
+
+static size_t put_varint(byte *p, u_int32_t v)
+{
+    size_t n = 0;
+
+    while (v >= 0x80) {
+	p[n++] = (byte)(v | 0x80);
+	v >>= 7;
+    }
+    p[n++] = (byte)v;
+    return n;
+}
+
+/* \return false if the varint at *p runs past end or is too long */
+static bool get_varint(const byte **p, const byte *end, u_int32_t *v)
+{
+    uint shift;
+
+    *v = 0;
+    for (shift = 0; shift < 35 && *p < end; shift += 7) {
+	byte b = *(*p)++;
+	*v |= (u_int32_t)(b & 0x7f) << shift;
+	if ((b & 0x80) == 0)
+	    return true;
+    }
+    return false;
+}
+
+#define	ZIGZAG(d)	(((u_int32_t)(d) << 1) ^ (u_int32_t)((d) >> 31))
+#define	UNZIGZAG(u)	((int32_t)(((u) >> 1) ^ (0 - ((u) & 1))))
+
+static word_t *applied_token(u_int64_t node)
+{
+    char name[sizeof(REPL_APPLIED) + 16];
+    snprintf(name, sizeof(name), REPL_APPLIED "%08lx%08lx",
+	     (unsigned long)(node >> 32), (unsigned long)(node & 0xffffffff));
+    return word_news(name);
+}
+
+/* read a meta token's counts, zero if there is none */
+static int read_meta(void *dsh, word_t *token, dsv_t *val)
+{
+    int ret = ds_read(dsh, token, val);
+    if (ret == 1) {
+	memset(val, 0, sizeof(*val));
+	ret = 0;
+    }
+    return ret;
+}
+
+/* the wordlist's node id, made up at its first export */
+static int get_node(void *dsh, u_int64_t *node, bool create)
+{
+    word_t *token = word_news(REPL_NODE);
+    dsv_t val;
+    int ret;
+
+    ret = read_meta(dsh, token, &val);
+    if (ret == 0) {
+	*node = ((u_int64_t)val.count[0] << 32) | val.count[1];
+	if (*node == 0 && create) {
+	    val.count[0] = (u_int32_t)gethostid() ^ ((u_int32_t)getpid() << 16);
+	    val.count[1] = (u_int32_t)time(NULL);
+	    *node = ((u_int64_t)val.count[0] << 32) | val.count[1];
+	    ret = ds_write(dsh, token, &val);
+	}
+    }
+    word_free(token);
+
+    return ret;
+}
+
+/* encode the changes of wh, sorted, after the header */
+static byte *encode_delta(wordhash_t *wh, const dhead_t *head, size_t *len)
+{
+    hashnode_t *node;
+    const word_t *prev = NULL;
+    size_t size = HEADER_SIZE, used;
+    byte *buf;
+
+    wordhash_sort(wh);
+    for (node = (hashnode_t *)wordhash_first(wh); node != NULL; node = (hashnode_t *)wordhash_next(wh))
+	size += 4 * 5 + node->key->leng;
+    buf = (byte *)xmalloc(size);
+
+    memcpy(buf, DELTA_MAGIC, MAGIC_SIZE);
+    put_u32(buf + MAGIC_SIZE, (u_int32_t)(head->node >> 32));
+    put_u32(buf + MAGIC_SIZE + 4, (u_int32_t)head->node);
+    put_u32(buf + MAGIC_SIZE + 8, head->generation);
+    put_u32(buf + MAGIC_SIZE + 12, head->count);
+    used = HEADER_SIZE;
+
+    for (node = (hashnode_t *)wordhash_first(wh); node != NULL; node = (hashnode_t *)wordhash_next(wh)) {
+	const word_t *key = node->key;
+	jdelta_t *d = (jdelta_t *)node->data;
+	uint shared = 0;
+
+	if (prev != NULL)
+	    while (shared < prev->leng && shared < key->leng &&
+		   prev->u.text[shared] == key->u.text[shared])
+		shared += 1;
+
+	used += put_varint(buf + used, shared);
+	used += put_varint(buf + used, key->leng - shared);
+	memcpy(buf + used, key->u.text + shared, key->leng - shared);
+	used += key->leng - shared;
+	used += put_varint(buf + used, ZIGZAG(d->delta[IX_SPAM]));
+	used += put_varint(buf + used, ZIGZAG(d->delta[IX_GOOD]));
+	prev = key;
+    }
+
+    *len = used;
+    return buf;
+}
+
+static void invalid_delta(void)
+{
+    fprintf(stderr, "Invalid delta.\n");
+    exit(EX_ERROR);
+}
+
+/* decode a delta into its header and the changes in wh */
+static void decode_delta(const byte *buf, size_t len, dhead_t *head, wordhash_t *wh)
+{
+    const byte *p = buf + HEADER_SIZE, *end = buf + len;
+    byte *text = NULL;
+    size_t size = 0;
+    u_int32_t i, prev = 0;
+
+    if (len < HEADER_SIZE || memcmp(buf, DELTA_MAGIC, MAGIC_SIZE) != 0)
+	invalid_delta();
+
+    head->node = ((u_int64_t)get_u32(buf + MAGIC_SIZE) << 32) |
+	get_u32(buf + MAGIC_SIZE + 4);
+    head->generation = get_u32(buf + MAGIC_SIZE + 8);
+    head->count = get_u32(buf + MAGIC_SIZE + 12);
+
+    for (i = 0; i < head->count; i += 1) {
+	u_int32_t shared, rest, spam, good;
+	word_t token;
+
+	if (!get_varint(&p, end, &shared) || shared > prev ||
+	    !get_varint(&p, end, &rest) || rest > (size_t)(end - p))
+	    invalid_delta();
+	if (shared + rest > size) {
+	    size = shared + rest;
+	    text = (byte *)xrealloc(text, size);
+	}
+	memcpy(text + shared, p, rest);
+	p += rest;
+	if (!get_varint(&p, end, &spam) || !get_varint(&p, end, &good))
+	    invalid_delta();
+
+	token.u.text = text;
+	token.leng = prev = shared + rest;
+	journal_add_changes(wh, &token, UNZIGZAG(spam), UNZIGZAG(good));
+    }
+
+    if (p != end)
+	invalid_delta();
+
+    xfree(text);
+}
+
+static byte *read_all(FILE *fp, size_t *len)
+{
+    size_t size = 64 * 1024, used = 0, n;
+    byte *buf = (byte *)xmalloc(size);
+
+    while ((n = fread(buf + used, 1, size - used, fp)) != 0) {
+	used += n;
+	if (used == size) {
+	    size *= 2;
+	    buf = (byte *)xrealloc(buf, size);
+	}
+    }
+    if (ferror(fp)) {
+	fprintf(stderr, "Can't read delta.\n");
+	exit(EX_ERROR);
+    }
+
+    *len = used;
+    return buf;
+}
+
+/* collect the changes since the last export, and advance the
+ * generation, in the current transaction */
+static int export_delta(void *dsh, const bfpath *bfp, wordhash_t *wh,
+			jpos_t *pos, dhead_t *head)
+{
+    word_t *token;
+    dsv_t val;
+    int ret;
+
+    ret = replog_read(dsh, bfp, wh, pos);
+    if (ret == 1)
+	ret = 0;
+    if (ret == 0 && wh->count != 0)
+	ret = replog_mark(dsh, pos);
+    if (ret == 0)
+	ret = get_node(dsh, &head->node, true);
+    if (ret != 0)
+	return ret;
+
+    token = word_news(REPL_GENERATION);
+    ret = read_meta(dsh, token, &val);
+    if (ret == 0) {
+	val.count[0] += 1;
+	head->generation = val.count[0];
+	ret = ds_write(dsh, token, &val);
+    }
+    word_free(token);
+
+    head->count = wh->count;
+
+    return ret;
+}
+
+ex_t export_delta_file(bfpath *bfp)
+{
+    ex_t rc = EX_OK;
+    dsh_t *dsh;
+    void *dbe;
+    wordhash_t *wh = NULL;
+    jpos_t pos;
+    dhead_t head;
+    int ret;
+
+    dbe = ds_init(bfp);
+
+    dsh = (dsh_t *)ds_open(dbe, bfp, DS_WRITE);
+    if (dsh == NULL)
+	return EX_ERROR;
+
+    memset(&pos, 0, sizeof(pos));
+
+    do {
+	if (wh != NULL)
+	    wordhash_free(wh);
+	wh = wordhash_new();
+	if (ds_txn_begin(dsh) != DST_OK) {
+	    rc = EX_ERROR;
+	    break;
+	}
+	ret = export_delta(dsh, bfp, wh, &pos, &head);
+	if (ret == DS_ABORT_RETRY) {	/* the transaction was aborted */
+	    xfree(pos.id);
+	    lock_sleep(4 * 1000, 1000 * 1000);
+	}
+	else if (ret != 0) {
+	    (void) ds_txn_abort(dsh);
+	    rc = EX_ERROR;
+	}
+    } while (ret == DS_ABORT_RETRY);
+
+    /* write the delta only once its generation is committed: a delta
+     * whose export was rolled back would have its generation reused by
+     * the next export, whose changes the nodes that applied the first
+     * one would then skip */
+    if (rc == EX_OK) {
+	size_t len;
+	byte *buf = encode_delta(wh, &head, &len);
+
+	if (ds_txn_commit(dsh) != DST_OK) {
+	    fprintf(stderr, "Can't commit the export.\n");
+	    rc = EX_ERROR;
+	}
+	else if (fwrite(buf, 1, len, fpo) != len || fflush(fpo) != 0) {
+	    fprintf(stderr, "Can't write delta, generation %lu is lost.\n",
+		    (unsigned long)head.generation);
+	    rc = EX_ERROR;
+	}
+	xfree(buf);
+    }
+
+    if (rc == EX_OK && verbose)
+	fprintf(dbgout, "generation %lu, %lu token%s exported\n",
+		(unsigned long)head.generation, (unsigned long)head.count,
+		(head.count == 1) ? "" : "s");
+
+    if (rc == EX_OK && pos.id != NULL)
+	rc = replog_truncate(dsh, bfp, &pos);
+
+    if (wh != NULL)
+	wordhash_free(wh);
+    xfree(pos.id);
+
+    ds_close(dsh);
+    ds_cleanup(dbe);
+
+    return rc;
+}
+
+/* apply a delta unless it has been applied before, in the current
+ * transaction.  The deltas of a node are applied in the order of their
+ * generations, as the applied generation is all that is kept of them.
+ * \return 0, 1 if it was skipped, or an error */
+static int apply_delta(void *dsh, wordhash_t *wh, const dhead_t *head, uint *tokens)
+{
+    u_int64_t self;
+    word_t *token;
+    dsv_t val;
+    int ret;
+
+    ret = get_node(dsh, &self, false);
+    if (ret != 0)
+	return ret;
+    if (self == head->node) {
+	fprintf(stderr, "The delta is from this wordlist.\n");
+	return -1;
+    }
+
+    token = applied_token(head->node);
+    ret = read_meta(dsh, token, &val);
+    if (ret == 0 && head->generation <= val.count[0]) {
+	if (verbose)
+	    fprintf(dbgout, "generation %lu already applied\n",
+		    (unsigned long)head->generation);
+	ret = 1;
+    }
+    else if (ret == 0 && head->generation != val.count[0] + 1) {
+	fprintf(stderr, "Generation %lu of the node is not applied yet, "
+		"apply its deltas in order.\n",
+		(unsigned long)val.count[0] + 1);
+	ret = -1;
+    }
+    else if (ret == 0) {
+	ret = journal_apply(dsh, wh, tokens);
+	if (ret == 0) {
+	    val.count[0] = head->generation;
+	    ret = ds_write(dsh, token, &val);
+	}
+    }
+    word_free(token);
+
+    return ret;
+}
+
+ex_t apply_delta_file(bfpath *bfp)
+{
+    ex_t rc = EX_OK;
+    dsh_t *dsh;
+    void *dbe;
+    wordhash_t *wh;
+    dhead_t head;
+    uint tokens = 0;
+    size_t len;
+    byte *buf;
+    int ret;
+
+    buf = read_all(fpin, &len);
+    wh = wordhash_new();
+    decode_delta(buf, len, &head, wh);
+    xfree(buf);
+
+    dbe = ds_init(bfp);
+
+    dsh = (dsh_t *)ds_open(dbe, bfp, DS_WRITE);
+    if (dsh == NULL) {
+	wordhash_free(wh);
+	return EX_ERROR;
+    }
+
+    do {
+	if (ds_txn_begin(dsh) != DST_OK) {
+	    rc = EX_ERROR;
+	    break;
+	}
+	ret = apply_delta(dsh, wh, &head, &tokens);
+	switch (ret) {
+	case 0:
+	    if (ds_txn_commit(dsh) != DST_OK)
+		rc = EX_ERROR;
+	    break;
+	case 1:		/* already applied */
+	    (void) ds_txn_commit(dsh);
+	    break;
+	case DS_ABORT_RETRY:	/* the transaction was aborted */
+	    lock_sleep(4 * 1000, 1000 * 1000);
+	    break;
+	default:
+	    (void) ds_txn_abort(dsh);
+	    rc = EX_ERROR;
+	    break;
+	}
+    } while (ret == DS_ABORT_RETRY);
+
+    if (rc == EX_OK && ret == 0 && verbose)
+	fprintf(dbgout, "generation %lu, %u token%s applied\n",
+		(unsigned long)head.generation, tokens, (tokens == 1) ? "" : "s");
+
+    wordhash_free(wh);
+
+    ds_close(dsh);
+    ds_cleanup(dbe);
+
+    return rc;
+}
@@ -0,0 +1,26 @@
+/*****************************************************************************
+
+NAME:
+   delta.h -- prototypes for delta.c
+
+******************************************************************************/
+
+#ifndef DELTA_H
+#define DELTA_H
+
+/* the wordlist's node id and the generation of its last export */
+#define	REPL_NODE	".REPL_NODE"
+#define	REPL_GENERATION	".REPL_GENERATION"
+/* the generation of the last delta applied from a node, followed by
+ * the node id in hex */
+#define	REPL_APPLIED	".REPL:"
+
+/** Write the changes since the last export to fpo, for bogoutil
+ * --export-delta. */
+ex_t export_delta_file(bfpath *bfp);
+
+/** Add the delta read from fpin to the wordlist, for bogoutil
+ * --apply-delta. */
+ex_t apply_delta_file(bfpath *bfp);
+
+#endif	/* DELTA_H */
@@ -52,6 +52,11 @@ uint	token_count_fix = 0;
 uint	token_count_min = 0;
 uint	token_count_max = 0;
 
+uint	max_message_bytes   = 0;
+uint	max_message_tokens  = 0;
+uint	early_exit_interval = 0;
+bool	header_only = false;
+
 const char	*update_dir;
 /*@observer@*/
 const char	*stats_prefix;
@@ -84,6 +89,13 @@ double	ns_esf = NS_ESF;
 /* other */
 FILE	*fpo;
 uint	db_cachesize = DB_CACHESIZE;	/* in MB */
+bool	db_snapshot_reads = false;	/* readers don't wait for writers */
+uint	scan_threads = 1;
+bool	update_journal = false;		/* -u appends to the journal */
+bool	journal_overlay = false;	/* scoring adds the journal */
+bool	replication_log = false;	/* log changes for --export-delta */
+bool	negative_cache = false;		/* ds_read() asks the filter first */
+bool	key_encoding = false;		/* code the prefixes of new wordlists */
 bool	msg_count_file = false;
 char	*progtype = NULL;
 bool	unsure_stats = false;		/* true if print stats for unsures */
@@ -56,6 +56,11 @@ extern	uint	token_count_fix;
 extern	uint	token_count_min;
 extern	uint	token_count_max;
 
+extern	uint	max_message_bytes;	/* stop reading a message here */
+extern	uint	max_message_tokens;	/* stop collecting tokens here */
+extern	uint	early_exit_interval;	/* tokens between early scorings */
+extern	bool	header_only;		/* score the header only */
+
 extern	int	abort_on_error;
 extern	bool	stats_in_header;
 
@@ -108,6 +113,25 @@ extern	double ns_esf;
 #define	DB_CACHESIZE	4	/* in MB */
 extern	uint	db_cachesize;
 
+/* SQLite WAL mode, Berkeley DB multiversion concurrency control */
+extern	bool	db_snapshot_reads;
+
+/* readers for ds_foreach_parallel() */
+extern	uint	scan_threads;
+
+/* write-behind journal of -u, see journal.c */
+extern	bool	update_journal;
+extern	bool	journal_overlay;
+
+/* replication log for bogoutil --export-delta, see delta.c */
+extern	bool	replication_log;
+
+/* filter of the tokens, built by bogoutil --build-filter, see bloom.c */
+extern	bool	negative_cache;
+
+/* new wordlists store their keys with coded tag prefixes */
+extern	bool	key_encoding;
+
 /* other */
 
 extern FILE  *fpo;
@@ -30,10 +30,11 @@ AUTHOR:
 #include <stdlib.h>
 #include <errno.h>
 #include <assert.h>
+#include <string.h>
 #include "buff.h"
 #include "iconvert.h"
 
-extern	iconv_t cd;
+extern	converter_t *cd;
 
 static void iconv_print_error(int err, buff_t *src)
 {
@@ -184,6 +185,198 @@ static void convert(iconv_t xd, buff_t *restrict src, buff_t *restrict dst)
 		src->t.u.text, src->read, src->t.leng, src->size);
 }
 
+/* Built-in converters to UTF-8.  They give the same output as
+** convert() with the corresponding iconv descriptor, including the
+** handling of invalid bytes, without calling iconv().  The one
+** exception: UTF-8 sequences beyond U+10FFFF, which glibc passes
+** through, are invalid here as RFC 3629 requires.
+*/
+
+/* windows-1252 0x80 - 0x9f, 0 for undefined */
+static const unsigned short cp1252_high[32] = {
+    0x20AC, 0,      0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+    0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0,      0x017D, 0,
+    0,      0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+    0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0,      0x017E, 0x0178
+};
+
+/* length of the valid UTF-8 sequence at p, 0 if invalid or incomplete */
+static size_t utf8_seq_len(const byte *p, size_t left)
+{
+    byte c = p[0];
+    size_t i, n;
+
+    if (c < 0x80)
+	return 1;
+    if (c < 0xC2)			/* continuation byte or overlong */
+	return 0;
+    if (c < 0xE0)
+	n = 2;
+    else if (c < 0xF0)
+	n = 3;
+    else if (c < 0xF5)
+	n = 4;
+    else
+	return 0;
+
+    if (left < n)
+	return 0;
+    for (i = 1; i < n; i += 1)
+	if ((p[i] & 0xC0) != 0x80)
+	    return 0;
+
+    if ((c == 0xE0 && p[1] < 0xA0) ||	/* overlong */
+	(c == 0xED && p[1] > 0x9F) ||	/* surrogate */
+	(c == 0xF0 && p[1] < 0x90) ||	/* overlong */
+	(c == 0xF4 && p[1] > 0x8F))	/* above U+10FFFF */
+	return 0;
+
+    return n;
+}
+
+static void convert_builtin(cv_kind_t kind, buff_t *restrict src, buff_t *restrict dst)
+{
+    const byte *in  = src->t.u.text + src->read;
+    const byte *end = src->t.u.text + src->t.leng;
+    byte *out = dst->t.u.text + dst->t.leng;
+    byte *lim = dst->t.u.text + dst->size;
+
+    BOGO_ASSERT(dst->size >= dst->t.leng, "outbytesleft underflow!");
+
+    while (in < end && out < lim) {
+	byte c = *in;
+	unsigned int u = c;
+	size_t n;
+
+	if (c < 0x80) {
+	    *out++ = c;
+	    in += 1;
+	    continue;
+	}
+
+	switch (kind) {
+	case CV_UTF8:
+	    n = utf8_seq_len(in, (size_t)(end - in));
+	    if (n != 0) {
+		if ((size_t)(lim - out) < n) {
+		    lim = out;		/* output buffer full */
+		    continue;
+		}
+		memcpy(out, in, n);
+		out += n;
+		in  += n;
+		continue;
+	    }
+	    u = 0;
+	    break;
+	case CV_CP1252:
+	    if (c < 0xA0)
+		u = cp1252_high[c - 0x80];
+	    break;
+	case CV_LATIN1:
+	    break;
+	case CV_ASCII:
+	case CV_ICONV:
+	    u = 0;
+	    break;
+	}
+
+	if (u == 0) {
+	    /* invalid byte, copy it (or substitute a '?') */
+	    *out++ = replace_nonascii_characters ? (byte) '?' : c;
+	    in += 1;
+	    continue;
+	}
+
+	n = (u < 0x800) ? 2 : 3;
+	if ((size_t)(lim - out) < n) {
+	    lim = out;			/* output buffer full */
+	    continue;
+	}
+	if (n == 2) {
+	    *out++ = (byte) (0xC0 | (u >> 6));
+	} else {
+	    *out++ = (byte) (0xE0 | (u >> 12));
+	    *out++ = (byte) (0x80 | ((u >> 6) & 0x3F));
+	}
+	*out++ = (byte) (0x80 | (u & 0x3F));
+	in += 1;
+    }
+
+    src->read = (uint) (in - src->t.u.text);
+    dst->t.leng = (uint) (out - dst->t.u.text);
+
+    Z(dst->t.u.text[dst->t.leng]);	/* for easier debugging - removable */
+}
+
+/* Pre-scan for the common case of text the converter would not
+** change.  Words of sizeof(long) bytes are tested at once for bytes
+** with the high bit set.
+*/
+
+#define	HIGH_BITS	(~0UL / 0xFF * 0x80)
+
+/* length of the leading run of ASCII bytes */
+static size_t ascii_prefix_len(const byte *text, size_t len)
+{
+    size_t i = 0;
+
+    for (; i + sizeof(unsigned long) <= len; i += sizeof(unsigned long)) {
+	unsigned long w;
+	memcpy(&w, text + i, sizeof(w));
+	if (w & HIGH_BITS)
+	    break;
+    }
+
+    while (i < len && text[i] < 0x80)
+	i += 1;
+
+    return i;
+}
+
+/* length of the leading run of valid UTF-8 sequences */
+static size_t utf8_prefix_len(const byte *text, size_t len)
+{
+    size_t i = 0;
+
+    while (i < len) {
+	size_t n;
+	i += ascii_prefix_len(text + i, len - i);
+	if (i == len)
+	    break;
+	n = utf8_seq_len(text + i, len - i);
+	if (n == 0)
+	    break;
+	i += n;
+    }
+
+    return i;
+}
+
+bool iconvert_ascii_transparent(void)
+{
+    return cd != NULL && cd->kind != CV_ICONV;
+}
+
+size_t iconvert_identity_len(const byte *text, size_t len)
+{
+    if (cd == NULL)
+	return 0;
+
+    switch (cd->kind) {
+    case CV_UTF8:
+	return utf8_prefix_len(text, len);
+    case CV_ASCII:
+    case CV_LATIN1:
+    case CV_CP1252:
+	return ascii_prefix_len(text, len);
+    case CV_ICONV:
+	break;
+    }
+
+    return 0;
+}
+
 static void copy(buff_t *restrict src, buff_t *restrict dst)
 {
     /* if conversion not available, use memcpy */
@@ -193,18 +386,16 @@ static void copy(buff_t *restrict src, buff_t *restrict dst)
 
 void iconvert(buff_t *restrict src, buff_t *restrict dst)
 {
-    assert(src->t.u.text != dst->t.u.text);
-    if (cd == NULL)
-	copy(src, dst);
-    else
-	convert(cd, src, dst);
+    iconvert_cd(cd, src, dst);
 }
 
-void iconvert_cd(iconv_t xd, buff_t *restrict src, buff_t *restrict dst)
+void iconvert_cd(converter_t *cv, buff_t *restrict src, buff_t *restrict dst)
 {
     assert(src->t.u.text != dst->t.u.text);
-    if (xd == (iconv_t)-1)
+    if (cv == NULL || (cv->kind == CV_ICONV && cv->xd == (iconv_t)-1))
 	copy(src, dst);
+    else if (cv->kind == CV_ICONV)
+	convert(cv->xd, src, dst);
     else
-	convert(xd, src, dst);
+	convert_builtin(cv->kind, src, dst);
 }
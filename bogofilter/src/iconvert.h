@@ -13,9 +13,17 @@ AUTHOR:
 
 #include "config.h"
 
-#include <iconv.h>
+#include "convert_unicode.h"
 
 extern void iconvert(buff_t *restrict src, buff_t *restrict dst);
-extern void iconvert_cd(iconv_t cd, buff_t *restrict src, buff_t *restrict dst);
+extern void iconvert_cd(converter_t *cv, buff_t *restrict src, buff_t *restrict dst);
+
+/** \return true if the current converter passes ASCII unchanged, in
+ * any state, so that iconvert_identity_len() can be used */
+extern bool iconvert_ascii_transparent(void);
+
+/** \return length of the leading part of \a text, ending on a
+ * character boundary, that iconvert() would copy unchanged */
+extern size_t iconvert_identity_len(const byte *text, size_t len);
 
 #endif
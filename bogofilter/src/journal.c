@@ -0,0 +1,851 @@
+/*****************************************************************************
+
+NAME:
+   journal.c -- write-behind journal for the registrations of -u.
+
+   With update_journal set, bogofilter -u does not update the wordlist
+   for a message it registers.  It appends the changes to the journal,
+   a text file next to the wordlist, and "bogoutil --fold-journal"
+   adds them to the wordlist later, all at once and sorted by token.
+
+   The journal starts with a line "#journal <id>", followed by one
+   line per token and message:
+	<token> <change of spam count> <change of good count>
+   with .MSG_COUNT for the message counts.  How far the journal has
+   been folded is stored in the wordlist, in the same transaction as
+   the counts, as token ".JOURNAL:<id>"; an interrupted fold therefore
+   neither loses nor repeats changes.  Once all of it is folded, the
+   journal is emptied, and the next append starts it with a new id.
+
+   With replication_log set, registrations (and folds of the journal)
+   are also appended to the replication log, in the same format, from
+   which "bogoutil --export-delta" takes the local changes, see
+   delta.c.  Its position is stored as ".REPLOG:<id>".  Unlike the
+   journal, the replication log is written in the transaction that
+   changes the wordlist: the end of its committed records is stored in
+   the same transaction, as ".REPLOG_END", and what lies beyond is from
+   a transaction that failed and is dropped by the next append.
+
+******************************************************************************/
+
+#include "common.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "datastore.h"
+#include "journal.h"
+#include "mxcat.h"
+#include "perfstats.h"
+#include "rand_sleep.h"
+#include "wordhash.h"
+#include "wordlists.h"
+#include "xmalloc.h"
+#include "xstrdup.h"
+
+/* a log of changes to the counts, next to the wordlist */
+typedef struct {
+    const char *suffix;		/* of the file name */
+    const char *header;		/* of the first line, followed by the id */
+    const char *token;		/* followed by the id, holds the position */
+    const char *end_token;	/* holds the committed end, NULL if the
+				   log is not written in transactions */
+} jlog_t;
+
+static const jlog_t journal = { ".journal", "#journal ", JOURNAL_TOKEN, NULL };
+static const jlog_t replog  = { ".replog",  "#replog ",  REPLOG_TOKEN, REPLOG_END };
+
+/* changes not in the wordlist that classification adds, if
+ * journal_overlay is set */
+static wordhash_t *overlay;
+static const wordlist_t *overlay_list;
+
+static char *log_path(const jlog_t *log, const bfpath *bfp)
+{
+    return mxcat(bfp->filepath, log->suffix, NULL);
+}
+
+static word_t *log_token(const jlog_t *log, const char *id)
+{
+    char *text = mxcat(log->token, id, NULL);
+    word_t *token = word_news(text);
+    xfree(text);
+    return token;
+}
+
+static bool is_msg_count(const word_t *token)
+{
+    return token->leng == strlen(MSG_COUNT) &&
+	memcmp(token->u.text, MSG_COUNT, token->leng) == 0;
+}
+
+static u_int32_t add_delta(u_int32_t count, int32_t delta)
+{
+    if (delta < 0 && count < (u_int32_t)-delta)
+	return 0;
+    return count + delta;
+}
+
+/* lock the whole file, waiting if need be */
+static int journal_lock(int fd, short type)
+{
+    struct flock fl;
+    int ret;
+
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+
+    ret = fcntl(fd, F_SETLK, &fl);
+    if (ret != 0 && (errno == EAGAIN || errno == EACCES)) {
+	phase_t prev = PERFSTATS_ENTER(PH_LOCK_WAIT);
+	PERFSTATS_COUNT(PC_LOCK_WAITS, 1);
+	while ((ret = fcntl(fd, F_SETLKW, &fl)) != 0 && errno == EINTR)
+	    continue;
+	PERFSTATS_LEAVE(prev);
+    }
+
+    return ret;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+    while (len != 0) {
+	ssize_t n = write(fd, buf, len);
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return -1;
+	}
+	buf += n;
+	len -= n;
+    }
+    return 0;
+}
+
+static int read_at(int fd, char *buf, size_t len, off_t offset)
+{
+    size_t got = 0;
+
+    if (lseek(fd, offset, SEEK_SET) != offset)
+	return -1;
+
+    while (got < len) {
+	ssize_t n = read(fd, buf + got, len - got);
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return -1;
+	}
+	if (n == 0)
+	    break;
+	got += n;
+    }
+    return (int)got;
+}
+
+static void journal_error(const char *what, const char *path)
+{
+    fprintf(stderr, "Can't %s '%s': %s\n", what, path, strerror(errno));
+    exit(EX_ERROR);
+}
+
+/* read the file offset stored as token; \return 0, 1 if there is none
+ * (*offset is 0 then), or DS_ABORT_RETRY */
+static int read_offset(void *dsh, const word_t *token, off_t *offset)
+{
+    dsv_t val;
+    int ret = ds_read(dsh, token, &val);
+
+    *offset = 0;
+    if (ret == 0)
+	*offset = (off_t)val.count[0] | ((off_t)val.count[1] << 32);
+
+    return ret;
+}
+
+static int write_offset(void *dsh, const word_t *token, off_t offset)
+{
+    dsv_t val;
+
+    memset(&val, 0, sizeof(val));
+    val.count[0] = (u_int32_t)offset;
+    val.count[1] = (u_int32_t)((u_int64_t)offset >> 32);
+    return ds_write(dsh, token, &val);
+}
+
+void journal_add_changes(wordhash_t *wh, word_t *token, int32_t spam, int32_t good)
+{
+    jdelta_t *d = (jdelta_t *)wordhash_insert(wh, token, sizeof(jdelta_t), NULL);
+    d->delta[IX_SPAM] += spam;
+    d->delta[IX_GOOD] += good;
+}
+
+/* parse one record, without its newline */
+static bool parse_record(wordhash_t *wh, char *line, size_t len)
+{
+    char *sp1, *sp2, *end;
+    long spam, good;
+    word_t token;
+
+    line[len] = '\0';
+    sp2 = strrchr(line, ' ');
+    if (sp2 == NULL || sp2 == line)
+	return false;
+    *sp2 = '\0';
+    sp1 = strrchr(line, ' ');
+    if (sp1 == NULL || sp1 == line)
+	return false;
+
+    spam = strtol(sp1 + 1, &end, 10);
+    if (end == sp1 + 1 || *end != '\0')
+	return false;
+    good = strtol(sp2 + 1, &end, 10);
+    if (end == sp2 + 1 || *end != '\0')
+	return false;
+
+    token.u.text = (byte *)line;
+    token.leng = (uint)(sp1 - line);
+    journal_add_changes(wh, &token, (int32_t)spam, (int32_t)good);
+
+    return true;
+}
+
+
+/* Add the records of the log next to bfp that are not yet in the
+ * wordlist dsh to wh.  \return 0, 1 if there are none, or
+ * DS_ABORT_RETRY */
+static int log_read(const jlog_t *log, void *dsh, const bfpath *bfp,
+		    wordhash_t *wh, jpos_t *pos)
+{
+    int fd, ret = 0;
+    struct stat st;
+    off_t size, committed = -1;
+    char head[128];
+    char *path, *buf, *nl, *line;
+    int len;
+    word_t *token;
+
+    memset(pos, 0, sizeof(*pos));
+
+    /* records past the committed end are not (yet) in the wordlist; a
+     * log without an end record is from before it was kept */
+    if (log->end_token != NULL) {
+	token = word_news(log->end_token);
+	ret = read_offset(dsh, token, &committed);
+	word_free(token);
+	if (ret == 1)
+	    committed = -1;
+	else if (ret != 0)
+	    return ret;
+	else if (committed == 0)
+	    return 1;
+	ret = 0;
+    }
+
+    path = log_path(log, bfp);
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+	if (errno != ENOENT)
+	    journal_error("open", path);
+	xfree(path);
+	return 1;
+    }
+
+    /* wait for a process that is appending; one that appends in a
+     * transaction doesn't change the committed records */
+    if ((log->end_token == NULL && journal_lock(fd, F_RDLCK) != 0) ||
+	fstat(fd, &st) != 0)
+	journal_error("lock", path);
+
+    size = st.st_size;
+    if (committed >= 0 && committed < size)
+	size = committed;
+
+    len = read_at(fd, head, (size_t)min(size, (off_t)sizeof(head) - 1), 0);
+    if (len < 0)
+	journal_error("read", path);
+    head[len] = '\0';
+    nl = strchr(head, '\n');
+    if (len == 0 || nl == NULL ||
+	strncmp(head, log->header, strlen(log->header)) != 0) {
+	close(fd);
+	if (len == 0) {
+	    xfree(path);
+	    return 1;
+	}
+	fprintf(stderr, "'%s' has no valid header.\n", path);
+	exit(EX_ERROR);
+    }
+    *nl = '\0';
+    pos->id = xstrdup(head + strlen(log->header));
+    pos->start = pos->end = nl + 1 - head;
+
+    token = log_token(log, pos->id);
+    {
+	off_t start;
+	ret = read_offset(dsh, token, &start);
+	if (ret == 1)
+	    ret = 0;
+	else if (ret == 0)
+	    pos->start = start;
+    }
+    word_free(token);
+
+    if (ret == 0 && pos->start < size) {
+	size_t rest = size - pos->start;
+	buf = (char *)xmalloc(rest + 1);
+	len = read_at(fd, buf, rest, pos->start);
+	if (len < 0)
+	    journal_error("read", path);
+
+	/* an incomplete last record is from an append that failed */
+	pos->end = pos->start;
+	for (line = buf; (nl = (char *)memchr(line, '\n', buf + len - line)) != NULL; line = nl + 1) {
+	    if (!parse_record(wh, line, nl - line))
+		pos->bad += 1;
+	    pos->end += nl + 1 - line;
+	}
+	xfree(buf);
+    }
+    else if (pos->start > pos->end)
+	pos->end = pos->start;
+
+    close(fd);
+    xfree(path);
+
+    if (ret == 0 && wh->count == 0)
+	ret = 1;
+
+    return ret;
+}
+
+/* store in the wordlist that the log is read up to pos->end */
+static int log_mark(const jlog_t *log, void *dsh, const jpos_t *pos)
+{
+    word_t *token = log_token(log, pos->id);
+    int ret = write_offset(dsh, token, pos->end);
+
+    word_free(token);
+
+    return ret;
+}
+
+/* log_truncate() of a log that is written in transactions: the
+ * wordlist is locked first, as by the appenders, and a failed
+ * transaction leaves the records */
+static ex_t log_truncate_txn(const jlog_t *log, void *dsh, const bfpath *bfp,
+			     const jpos_t *pos)
+{
+    struct stat st;
+    word_t *end_token, *token;
+    off_t end;
+    char *path;
+    int fd, ret;
+
+    if (ds_txn_begin(dsh) != DST_OK)
+	return EX_ERROR;
+
+    end_token = word_news(log->end_token);
+    token = log_token(log, pos->id);
+
+    /* keep appenders out until the commit */
+    ret = read_offset(dsh, end_token, &end);
+    if (ret == 0 || ret == 1)
+	ret = write_offset(dsh, end_token, end);
+
+    path = log_path(log, bfp);
+    fd = (ret == 0) ? open(path, O_RDWR) : -1;
+    if (ret == 0 && fd < 0)
+	journal_error("open", path);
+    if (fd >= 0) {
+	if (journal_lock(fd, F_WRLCK) != 0 || fstat(fd, &st) != 0)
+	    journal_error("lock", path);
+	if (end == 0 || end > st.st_size)
+	    end = st.st_size;
+	/* the next append starts the log with a new id */
+	if (end == pos->end) {
+	    ret = ds_delete(dsh, token);
+	    if (ret == 0)
+		ret = write_offset(dsh, end_token, 0);
+	    if (ret == 0 && ftruncate(fd, 0) != 0)
+		journal_error("truncate", path);
+	}
+	close(fd);
+    }
+    xfree(path);
+    word_free(token);
+    word_free(end_token);
+
+    switch (ret) {
+    case 0:
+	return (ds_txn_commit(dsh) == DST_OK) ? EX_OK : EX_ERROR;
+    case DS_ABORT_RETRY:	/* the records stay until the next export */
+	return EX_OK;
+    default:
+	(void) ds_txn_abort(dsh);
+	return EX_ERROR;
+    }
+}
+
+/* empty the log if nothing was appended since it was read up to
+ * pos->end, and forget its position */
+static ex_t log_truncate(const jlog_t *log, void *dsh, const bfpath *bfp,
+			 const jpos_t *pos)
+{
+    struct stat st;
+    bool emptied = false;
+    word_t *token;
+    char *path;
+    int fd;
+
+    if (log->end_token != NULL)
+	return log_truncate_txn(log, dsh, bfp, pos);
+
+    path = log_path(log, bfp);
+    fd = open(path, O_RDWR);
+    if (fd < 0)
+	journal_error("open", path);
+    if (journal_lock(fd, F_WRLCK) != 0 || fstat(fd, &st) != 0)
+	journal_error("lock", path);
+    if (st.st_size == pos->end) {
+	if (ftruncate(fd, 0) != 0)
+	    journal_error("truncate", path);
+	emptied = true;
+    }
+    close(fd);
+    xfree(path);
+
+    if (!emptied)
+	return EX_OK;
+
+    /* the next append starts the log with a new id */
+    token = log_token(log, pos->id);
+    if (ds_txn_begin(dsh) != DST_OK)
+	return EX_ERROR;
+    if (ds_delete(dsh, token) != 0) {
+	(void) ds_txn_abort(dsh);
+	word_free(token);
+	return EX_ERROR;
+    }
+    word_free(token);
+
+    return (ds_txn_commit(dsh) == DST_OK) ? EX_OK : EX_ERROR;
+}
+
+/* write records to the log file fd of size bytes, at its end, starting
+ * it if it is empty; \return the new size */
+static off_t log_write(const jlog_t *log, int fd, const char *path, off_t size,
+		       const char *records, size_t len)
+{
+    char head[128];
+    size_t used = 0;
+
+    if (size == 0)
+	used = snprintf(head, sizeof(head), "%s%lx.%lx\n", log->header,
+			(unsigned long)time(NULL), (unsigned long)getpid());
+    else {
+	/* end an incomplete record */
+	if (read_at(fd, head, 1, size - 1) != 1)
+	    journal_error("read", path);
+	if (head[0] != '\n') {
+	    head[0] = '\n';
+	    used = 1;
+	}
+    }
+
+    if (lseek(fd, size, SEEK_SET) != size ||
+	write_all(fd, head, used) != 0 ||
+	write_all(fd, records, len) != 0)
+	journal_error("write to", path);
+
+    return size + used + len;
+}
+
+/* append records to the log next to bfp, starting it if it is empty */
+static void log_append(const jlog_t *log, const bfpath *bfp,
+		       const char *records, size_t len)
+{
+    char *path;
+    struct stat st;
+    int fd;
+
+    path = log_path(log, bfp);
+    fd = open(path, O_RDWR | O_APPEND | O_CREAT, DS_MODE);
+    if (fd < 0)
+	journal_error("open", path);
+    if (journal_lock(fd, F_WRLCK) != 0 || fstat(fd, &st) != 0)
+	journal_error("lock", path);
+
+    (void) log_write(log, fd, path, st.st_size, records, len);
+    if (close(fd) != 0)
+	journal_error("close", path);
+
+    xfree(path);
+}
+
+/* Append records to a log that is written in transactions, in the
+ * transaction of dsh: records past the committed end are from a
+ * transaction that failed, and are overwritten.  The records are on
+ * disk before the new end is stored.  \return 0 or the error of the
+ * data store */
+static int log_append_txn(const jlog_t *log, void *dsh, const bfpath *bfp,
+			  const char *records, size_t len)
+{
+    word_t *end_token = word_news(log->end_token);
+    char *path;
+    struct stat st;
+    off_t end;
+    int fd, ret;
+
+    /* the write keeps other appenders out until the commit */
+    ret = read_offset(dsh, end_token, &end);
+    if (ret == 0 || ret == 1) {
+	int found = ret;
+	ret = write_offset(dsh, end_token, end);
+	if (found == 1)
+	    end = -1;
+    }
+    if (ret != 0) {
+	word_free(end_token);
+	return ret;
+    }
+
+    path = log_path(log, bfp);
+    fd = open(path, O_RDWR | O_CREAT, DS_MODE);
+    if (fd < 0)
+	journal_error("open", path);
+    if (journal_lock(fd, F_WRLCK) != 0 || fstat(fd, &st) != 0)
+	journal_error("lock", path);
+
+    /* without an end record, the log is from before it was kept */
+    if (end < 0 || end > st.st_size)
+	end = st.st_size;
+    if (end < st.st_size && ftruncate(fd, end) != 0)
+	journal_error("truncate", path);
+
+    end = log_write(log, fd, path, end, records, len);
+    if (fsync(fd) != 0)
+	journal_error("write to", path);
+    if (close(fd) != 0)
+	journal_error("close", path);
+    xfree(path);
+
+    ret = write_offset(dsh, end_token, end);
+    word_free(end_token);
+
+    return ret;
+}
+
+static size_t format_record(char *buf, const word_t *key, int32_t spam, int32_t good)
+{
+    memcpy(buf, key->u.text, key->leng);
+    return key->leng + sprintf(buf + key->leng, " %ld %ld\n", (long)spam, (long)good);
+}
+
+#define	RECORD_SIZE(leng)	((leng) + 2 * 12 + 3)
+
+/* Format the registration of the tokens of h and of msgcount messages
+ * as records, and add it to apply (unless NULL).  \return the records,
+ * their length in *len */
+static char *format_registration(sh_t incr, sh_t decr, wordhash_t *h,
+				 u_int32_t msgcount, size_t *len,
+				 wordhash_t *apply)
+{
+    hashnode_t *node;
+    char *buf;
+    size_t size, used = 0;
+    word_t msg_count;
+    int32_t d[IX_SIZE];
+
+    msg_count.u.ctext = MSG_COUNT;
+    msg_count.leng = strlen(MSG_COUNT);
+
+    size = RECORD_SIZE(msg_count.leng);
+    for (node = (hashnode_t *)wordhash_first(h); node != NULL; node = (hashnode_t *)wordhash_next(h))
+	size += RECORD_SIZE(node->key->leng);
+    buf = (char *)xmalloc(size);
+
+    for (node = (hashnode_t *)wordhash_first(h); node != NULL; node = (hashnode_t *)wordhash_next(h)) {
+	wordprop_t *wordprop = (wordprop_t *)node->data;
+
+	d[IX_SPAM] = d[IX_GOOD] = 0;
+	if (incr != IX_UNDF)
+	    d[incr] += wordprop->freq;
+	if (decr != IX_UNDF)
+	    d[decr] -= wordprop->freq;
+
+	used += format_record(buf + used, node->key, d[IX_SPAM], d[IX_GOOD]);
+	if (apply != NULL)
+	    journal_add_changes(apply, node->key, d[IX_SPAM], d[IX_GOOD]);
+    }
+
+    if (msgcount != 0) {
+	d[IX_SPAM] = d[IX_GOOD] = 0;
+	if (incr != IX_UNDF)
+	    d[incr] += msgcount;
+	if (decr != IX_UNDF)
+	    d[decr] -= msgcount;
+
+	used += format_record(buf + used, &msg_count, d[IX_SPAM], d[IX_GOOD]);
+	if (apply != NULL)
+	    journal_add_changes(apply, &msg_count, d[IX_SPAM], d[IX_GOOD]);
+    }
+
+    *len = used;
+    return buf;
+}
+
+/* format the summed changes of wh as records */
+static char *format_changes(wordhash_t *wh, size_t *len)
+{
+    hashnode_t *node;
+    char *buf;
+    size_t size = 0, used = 0;
+
+    for (node = (hashnode_t *)wordhash_first(wh); node != NULL; node = (hashnode_t *)wordhash_next(wh))
+	size += RECORD_SIZE(node->key->leng);
+    buf = (char *)xmalloc(size + 1);
+
+    for (node = (hashnode_t *)wordhash_first(wh); node != NULL; node = (hashnode_t *)wordhash_next(wh)) {
+	jdelta_t *d = (jdelta_t *)node->data;
+	used += format_record(buf + used, node->key, d->delta[IX_SPAM], d->delta[IX_GOOD]);
+    }
+
+    *len = used;
+    return buf;
+}
+
+void journal_append(sh_t incr, sh_t decr, wordhash_t *h, u_int32_t msgcount)
+{
+    wordlist_t *list = get_default_wordlist(word_lists);
+    bool apply = (overlay != NULL && overlay_list == list);
+    size_t len;
+    char *buf;
+
+    buf = format_registration(incr, decr, h, msgcount, &len, apply ? overlay : NULL);
+    log_append(&journal, list->bfp, buf, len);
+    xfree(buf);
+
+    /* the message counts with the overlay */
+    if (apply && msgcount != 0) {
+	if (incr != IX_UNDF)
+	    list->msgcount[incr] += msgcount;
+	if (decr != IX_UNDF)
+	    list->msgcount[decr] = add_delta(list->msgcount[decr], -(int32_t)msgcount);
+    }
+}
+
+int replog_append(void *dsh, const bfpath *bfp,
+		  sh_t incr, sh_t decr, wordhash_t *h, u_int32_t msgcount)
+{
+    size_t len;
+    char *buf;
+    int ret;
+
+    if (!replication_log)
+	return 0;
+
+    buf = format_registration(incr, decr, h, msgcount, &len, NULL);
+    ret = log_append_txn(&replog, dsh, bfp, buf, len);
+    xfree(buf);
+
+    return ret;
+}
+
+int journal_load(wordlist_t *list)
+{
+    jpos_t pos;
+    jdelta_t *mc;
+    word_t msg_count;
+    int ret;
+
+    if (!journal_overlay || list != get_default_wordlist(word_lists))
+	return 0;
+
+    if (overlay != NULL)
+	wordhash_free(overlay);
+    overlay = wordhash_new();
+    overlay_list = list;
+
+    ret = log_read(&journal, list->dsh, list->bfp, overlay, &pos);
+    xfree(pos.id);
+
+    if (ret == DS_ABORT_RETRY)
+	return ret;
+
+    msg_count.u.ctext = MSG_COUNT;
+    msg_count.leng = strlen(MSG_COUNT);
+    mc = (jdelta_t *)wordhash_search(overlay, &msg_count, 0);
+    if (mc != NULL) {
+	list->msgcount[IX_SPAM] = add_delta(list->msgcount[IX_SPAM], mc->delta[IX_SPAM]);
+	list->msgcount[IX_GOOD] = add_delta(list->msgcount[IX_GOOD], mc->delta[IX_GOOD]);
+    }
+
+    return 0;
+}
+
+bool journal_lookup(const wordlist_t *list, const word_t *token, dsv_t *val)
+{
+    jdelta_t *d;
+
+    if (overlay == NULL || list != overlay_list)
+	return false;
+
+    d = (jdelta_t *)wordhash_search(overlay, token, 0);
+    if (d == NULL)
+	return false;
+
+    val->count[IX_SPAM] = add_delta(val->count[IX_SPAM], d->delta[IX_SPAM]);
+    val->count[IX_GOOD] = add_delta(val->count[IX_GOOD], d->delta[IX_GOOD]);
+    val->prob_gen = 0;		/* the stored probability is stale */
+
+    return true;
+}
+
+int journal_apply(void *dsh, wordhash_t *wh, uint *tokens)
+{
+    hashnode_t *node;
+    jdelta_t *mc = NULL;
+    dsv_t val;
+    int ret = 0;
+
+    *tokens = 0;
+
+    wordhash_sort_by(wh, ds_keys_coded(dsh) ? ds_coded_key_cmp : word_cmp);
+    for (node = (hashnode_t *)wordhash_first(wh); node != NULL; node = (hashnode_t *)wordhash_next(wh)) {
+	jdelta_t *d = (jdelta_t *)node->data;
+
+	if (is_msg_count(node->key)) {
+	    mc = d;
+	    continue;
+	}
+
+	ret = ds_read(dsh, node->key, &val);
+	if (ret == 1)
+	    memset(&val, 0, sizeof(val));
+	else if (ret != 0)
+	    return ret;
+	val.count[IX_SPAM] = add_delta(val.count[IX_SPAM], d->delta[IX_SPAM]);
+	val.count[IX_GOOD] = add_delta(val.count[IX_GOOD], d->delta[IX_GOOD]);
+	ret = ds_write(dsh, node->key, &val);
+	if (ret != 0)
+	    return ret;
+	*tokens += 1;
+    }
+
+    if (mc != NULL) {
+	ret = ds_get_msgcounts(dsh, &val);
+	if (ret == 1) {
+	    memset(&val, 0, sizeof(val));
+	    ret = 0;
+	}
+	if (ret == 0) {
+	    val.spamcount = add_delta(val.spamcount, mc->delta[IX_SPAM]);
+	    val.goodcount = add_delta(val.goodcount, mc->delta[IX_GOOD]);
+	    ret = ds_set_msgcounts(dsh, &val);
+	}
+    }
+
+    return ret;
+}
+
+ex_t fold_journal_file(bfpath *bfp)
+{
+    ex_t rc = EX_OK;
+    dsh_t *dsh;
+    void *dbe;
+    wordhash_t *wh = NULL;
+    jpos_t pos;
+    uint tokens = 0;
+    int ret;
+
+    dbe = ds_init(bfp);
+
+    dsh = (dsh_t *)ds_open(dbe, bfp, DS_WRITE);
+    if (dsh == NULL)
+	return EX_ERROR;
+
+    memset(&pos, 0, sizeof(pos));
+
+    do {
+	if (wh != NULL)
+	    wordhash_free(wh);
+	wh = wordhash_new();
+	if (ds_txn_begin(dsh) != DST_OK) {
+	    rc = EX_ERROR;
+	    break;
+	}
+	/* add the unfolded records in key order, and store how far the
+	 * journal is folded, in one transaction; folded registrations
+	 * are local ones, for --export-delta */
+	ret = log_read(&journal, dsh, bfp, wh, &pos);
+	if (ret == 0)
+	    ret = journal_apply(dsh, wh, &tokens);
+	if (ret == 0)
+	    ret = log_mark(&journal, dsh, &pos);
+	if (ret == 0 && replication_log) {
+	    size_t len;
+	    char *buf = format_changes(wh, &len);
+	    ret = log_append_txn(&replog, dsh, bfp, buf, len);
+	    xfree(buf);
+	}
+	switch (ret) {
+	case 0:
+	    if (ds_txn_commit(dsh) != DST_OK)
+		rc = EX_ERROR;
+	    break;
+	case 1:		/* nothing to fold */
+	    (void) ds_txn_commit(dsh);
+	    break;
+	case DS_ABORT_RETRY:	/* the transaction was aborted */
+	    xfree(pos.id);
+	    lock_sleep(4 * 1000, 1000 * 1000);
+	    break;
+	default:
+	    (void) ds_txn_abort(dsh);
+	    rc = EX_ERROR;
+	    break;
+	}
+    } while (ret == DS_ABORT_RETRY);
+
+    if (pos.bad != 0)
+	fprintf(stderr, "Journal of '%s': %u malformed record%s skipped.\n",
+		bfp->filepath, pos.bad, (pos.bad == 1) ? "" : "s");
+
+    if (rc == EX_OK && verbose)
+	fprintf(dbgout, "%u token%s folded into '%s'\n",
+		tokens, (tokens == 1) ? "" : "s", bfp->filepath);
+
+    if (rc == EX_OK && pos.id != NULL)
+	rc = log_truncate(&journal, dsh, bfp, &pos);
+
+    if (wh != NULL)
+	wordhash_free(wh);
+    xfree(pos.id);
+
+    ds_close(dsh);
+    ds_cleanup(dbe);
+
+    return rc;
+}
+
+int replog_read(void *dsh, const bfpath *bfp, wordhash_t *wh, jpos_t *pos)
+{
+    return log_read(&replog, dsh, bfp, wh, pos);
+}
+
+int replog_mark(void *dsh, const jpos_t *pos)
+{
+    return log_mark(&replog, dsh, pos);
+}
+
+ex_t replog_truncate(void *dsh, const bfpath *bfp, const jpos_t *pos)
+{
+    return log_truncate(&replog, dsh, bfp, pos);
+}
@@ -0,0 +1,83 @@
+/*****************************************************************************
+
+NAME:
+   journal.h -- write-behind journal for the registrations of -u,
+		and the replication log.
+
+******************************************************************************/
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "datastore.h"
+#include "wordhash.h"
+#include "wordlists.h"
+
+/* Key prefix of the record that holds how far the journal is folded;
+ * the rest of the key is the journal's id. */
+#define	JOURNAL_TOKEN	".JOURNAL:"
+
+/* the same for the replication log, up to where it is exported */
+#define	REPLOG_TOKEN	".REPLOG:"
+
+/* the end of the replication log's committed records */
+#define	REPLOG_END	".REPLOG_END"
+
+/* changes to a token, summed over a log's records */
+typedef struct {
+    int32_t delta[IX_SIZE];
+} jdelta_t;
+
+/* the part of a log not yet in the wordlist */
+typedef struct {
+    char  *id;		/* from the header, NULL if the log is empty */
+    off_t  start;
+    off_t  end;		/* just past the last complete record */
+    uint   bad;		/* malformed records, skipped */
+} jpos_t;
+
+/** Append the registration of the tokens of \a h and of \a msgcount
+ * messages to the journal of the default wordlist, incrementing the
+ * counts of \a incr and decrementing those of \a decr (or IX_UNDF). */
+void journal_append(sh_t incr, sh_t decr, wordhash_t *h, u_int32_t msgcount);
+
+/** As journal_append(), for the replication log of the wordlist \a
+ * dsh, if replication_log is set, in the transaction that registers
+ * the tokens.  \return 0 or the error of ds_read() or ds_write(),
+ * e.g. DS_ABORT_RETRY */
+int replog_append(void *dsh, const bfpath *bfp, sh_t incr, sh_t decr,
+		  wordhash_t *h, u_int32_t msgcount);
+
+/** Read the changes of \a list's journal that are not yet in the
+ * wordlist, and add the message counts among them to the list's.  To
+ * be called after each (re)start of the wordlist's transaction.
+ * \return 0 or DS_ABORT_RETRY */
+int journal_load(wordlist_t *list);
+
+/** Add the changes to \a token loaded by journal_load() to \a val,
+ * the token's counts in \a list.  \return true if there were any. */
+bool journal_lookup(const wordlist_t *list, const word_t *token, dsv_t *val);
+
+/** Add \a spam and \a good to the changes of \a token in \a wh. */
+void journal_add_changes(wordhash_t *wh, word_t *token, int32_t spam, int32_t good);
+
+/** Add the changes in \a wh (of jdelta_t, with .MSG_COUNT for the
+ * message counts) to the wordlist, in key order.  \return 0, or the
+ * error of ds_read() or ds_write(), e.g. DS_ABORT_RETRY */
+int journal_apply(void *dsh, wordhash_t *wh, uint *tokens);
+
+/** Add the journal of the wordlist to the wordlist, for bogoutil
+ * --fold-journal. */
+ex_t fold_journal_file(bfpath *bfp);
+
+/** Read the replication log's records that are not yet exported into
+ * \a wh.  \return 0, 1 if there are none, or DS_ABORT_RETRY */
+int replog_read(void *dsh, const bfpath *bfp, wordhash_t *wh, jpos_t *pos);
+
+/** Store that the replication log is exported up to \a pos. */
+int replog_mark(void *dsh, const jpos_t *pos);
+
+/** Empty the replication log if it is all exported. */
+ex_t replog_truncate(void *dsh, const bfpath *bfp, const jpos_t *pos);
+
+#endif	/* JOURNAL_H */
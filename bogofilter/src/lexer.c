@@ -26,6 +26,7 @@
 #include "memstr.h"
 #include "mime.h"
 #include "msgcounts.h"
+#include "perfstats.h"
 #include "qp.h"
 #include "textblock.h"
 #include "token.h"
@@ -47,6 +48,18 @@ static lexer_t v3_lexer = {
     lexer_v3_get_token
 };
 
+/* bytes seen by each stage of the line pipeline (-x l) */
+static struct {
+    unsigned long read;		/* read from the input */
+    unsigned long decoded;	/* after MIME decoding */
+    unsigned long inplace;	/* left in place, not copied */
+    unsigned long copied;	/* copied for the charset converter */
+    unsigned long converted;	/* produced by the charset converter */
+} line_bytes;
+
+static unsigned long msg_bytes;	/* bytes of this message read so far */
+static bool msg_eof;		/* reader has reached the end of the message */
+
 lexer_t msg_count_lexer = {
     read_msg_count_line,
     msg_count_get_token
@@ -66,6 +79,38 @@ void lexer_init(void)
     token_init();
     lexer_v3_init(NULL);
     init_charset_table(charset_default);
+    msg_bytes = 0;
+    msg_eof = false;
+}
+
+/* Read the rest of the current message without tokenizing it, for
+ * when collecting stopped early.  Passthrough still gets the text. */
+void lexer_skip_message(void)
+{
+    static buff_t *skipbuff = NULL;
+
+    if (skipbuff == NULL)
+	skipbuff = buff_new((byte *) xmalloc(BUFSIZ+D), 0, BUFSIZ);
+
+    while (!msg_eof) {
+	int count;
+
+	skipbuff->t.leng = skipbuff->read = 0;
+	count = yy_get_new_line(skipbuff);
+	if (count <= 0)
+	    break;
+
+	msg_bytes += (unsigned long) count;
+	if (passthrough)
+	    textblock_add(skipbuff->t.u.text+skipbuff->read, (size_t) count);
+    }
+}
+
+void lexer_print_stats(FILE *fp)
+{
+    fprintf(fp, "lexer bytes: read %lu, decoded %lu, in place %lu, copied %lu, converted %lu\n",
+	    line_bytes.read, line_bytes.decoded, line_bytes.inplace,
+	    line_bytes.copied, line_bytes.converted);
 }
 
 static void lexer_display_buffer(buff_t *buff)
@@ -103,9 +148,14 @@ static bool long_token(byte *buf, uint count)
 
 static int yy_get_new_line(buff_t *buff)
 {
+    phase_t prev = PERFSTATS_ENTER(PH_READ);
     int count = (*reader_getline)(buff);
     const byte *buf = buff->t.u.text;
 
+    PERFSTATS_LEAVE(prev);
+    if (count > 0)
+	PERFSTATS_COUNT(PC_BYTES, (unsigned long) count);
+
     static size_t hdrlen = 0;
     if (hdrlen==0)
 	hdrlen=strlen(spam_header_name);
@@ -114,6 +164,7 @@ static int yy_get_new_line(buff_t *buff)
 	yylineno += 1;
 
     if (count == EOF) {
+	msg_eof = true;
 	if (fpin == NULL || !ferror(fpin)) {
 	    return YY_NULL;
 	}
@@ -146,6 +197,9 @@ static int yy_get_new_line(buff_t *buff)
 	count = skip_folded_line(buff);
     }
 
+    if (count == EOF)
+	msg_eof = true;
+
     return count;
 }
 
@@ -155,6 +209,10 @@ static int get_decoded_line(buff_t *buff)
     buff_t *linebuff;
     /* since msg_state might change during calls */
     bool mime_dont_decode = msg_state->mime_dont_decode;
+#ifndef	DISABLE_UNICODE
+    static buff_t *tempbuff = NULL;
+    buff_t inplace;
+#endif
 
 #ifdef	DISABLE_UNICODE
     linebuff = buff;
@@ -164,8 +222,6 @@ static int get_decoded_line(buff_t *buff)
 	linebuff = buff;
     }
     else {
-	static buff_t *tempbuff = NULL;
-
 	if (tempbuff == NULL)
 	    tempbuff = (buff_t *) calloc(sizeof(buff_t), 1);
 
@@ -180,6 +236,20 @@ static int get_decoded_line(buff_t *buff)
 
 	tempbuff->t.leng = tempbuff->read = 0;
 	linebuff = tempbuff;
+
+	/* Most body lines are ASCII (or valid UTF-8) and come out of
+	 * the converter unchanged.  If the converter can tell, read
+	 * the line straight into the output buffer; it is moved to
+	 * tempbuff only when it needs converting.  Header lines may be
+	 * the reader's saved separator line, which buff_add() might
+	 * reallocate, so they always use tempbuff. */
+	if (encoding == E_UNICODE &&
+	    !msg_header &&
+	    iconvert_ascii_transparent() &&
+	    buff->size - buff->t.leng > tempbuff->size) {
+	    buff_init(&inplace, buff->t.u.text + buff->t.leng, 0, tempbuff->size);
+	    linebuff = &inplace;
+	}
     }
 #endif
 
@@ -187,6 +257,24 @@ static int get_decoded_line(buff_t *buff)
      * changing the global msg_state variable */
     count = yy_get_new_line(linebuff);
 
+    /* The body of a part that is not decoded (binary media types)
+     * would only give tokens that are thrown away.  Read it up to
+     * the next boundary without passing it to the scanner, counting
+     * its size for the part's summary tokens. */
+    while (count > 0 &&
+	   !msg_header &&
+	   msg_state->mime_dont_decode &&
+	   (max_message_bytes == 0 || msg_bytes < max_message_bytes))
+    {
+	if (passthrough)
+	    textblock_add(linebuff->t.u.text+linebuff->read, (size_t) count);
+	line_bytes.read += (unsigned long) count;
+	msg_bytes += (unsigned long) count;
+	mime_skipped((size_t) count);
+	linebuff->t.leng = linebuff->read;
+	count = yy_get_new_line(linebuff);
+    }
+
     if (count == EOF) {
 	if ( !ferror(fpin))
 	    return YY_NULL;
@@ -196,6 +284,11 @@ static int get_decoded_line(buff_t *buff)
 	}
     }
 
+    if (count > 0) {
+	line_bytes.read += (unsigned long) count;
+	msg_bytes += (unsigned long) count;
+    }
+
     /* Save the text on a linked list of lines.
      * Note that we store fixed-length blocks here, not lines.
      * One very long physical line could break up into more
@@ -224,12 +317,38 @@ static int get_decoded_line(buff_t *buff)
 	}
     }
 
+    if (count > 0)
+	line_bytes.decoded += (unsigned long) count;
+
 #ifndef	DISABLE_UNICODE
     if (encoding == E_UNICODE &&
 	!mime_dont_decode &&
         count > 0)
     {
-	iconvert(linebuff, buff);
+	uint before = buff->t.leng;
+
+	if (linebuff == &inplace) {
+	    /* Keep the part the converter would not change where it
+	     * is, move only the rest to tempbuff for converting. */
+	    uint keep = (inplace.read != 0) ? 0 :
+		(uint) iconvert_identity_len(inplace.t.u.text, inplace.t.leng);
+
+	    buff->t.leng += keep;
+	    line_bytes.inplace += keep;
+
+	    if (keep < inplace.t.leng) {
+		tempbuff->t.leng = inplace.t.leng - keep;
+		tempbuff->read = (keep == 0) ? inplace.read : 0;
+		memcpy(tempbuff->t.u.text, inplace.t.u.text + keep, tempbuff->t.leng);
+		line_bytes.copied += tempbuff->t.leng;
+		iconvert(tempbuff, buff);
+		line_bytes.converted += buff->t.leng - before - keep;
+	    }
+	}
+	else {
+	    iconvert(linebuff, buff);
+	    line_bytes.converted += buff->t.leng - before;
+	}
 
 	/* If we return count = 0 here, the caller will think we have
 	 * no more bytes left to read, even though before the iconvert
@@ -302,6 +421,11 @@ int yyinput(byte *buf, size_t size)
     int count = 0;
     buff_t buff;
 
+    /* with a byte cap, end the message for the scanner here; the
+     * rest is read by lexer_skip_message() */
+    if (max_message_bytes != 0 && msg_bytes >= max_message_bytes)
+	return 0;
+
     buff_init(&buff, buf, 0, (uint) size);
 
     /* After reading a line of text, check if it has special characters.
@@ -478,7 +602,7 @@ word_t *text_decode(word_t *w)
 
 #ifndef	DISABLE_UNICODE
 	if (encoding == E_UNICODE) {
-	    iconv_t cd;
+	    converter_t *cv;
 	    buff_t  src;
 
 	    /* convert 'word_t *w' to 'buff_t src' because
@@ -489,9 +613,10 @@ word_t *text_decode(word_t *w)
 	    src.read   = 0;
 	    src.size   = len;
 
-	    cd = bf_iconv_open( charset_unicode, charset );
-	    iconvert_cd(cd, &src, buf);
-	    iconv_close(cd);
+	    /* each encoded word starts in the initial shift state */
+	    cv = bf_converter_get( charset_unicode, charset );
+	    bf_converter_reset(cv);
+	    iconvert_cd(cv, &src, buf);
 
 	    if (DEBUG_LEXER(3)) {
 		fputs("**4**  ", dbgout);
@@ -62,6 +62,8 @@ extern void yy_set_state_initial(void);
 
 /* in lexer.c */
 extern void 	lexer_init(void);
+extern void	lexer_print_stats(FILE *fp);
+extern void	lexer_skip_message(void);
 extern void	yyinit(void);
 extern int	yyinput(byte *buf, size_t size);
 
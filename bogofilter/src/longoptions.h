@@ -38,21 +38,38 @@ typedef enum longopts_e {
     O_DB_LOG_AUTOREMOVE,
     O_DB_TRANSACTION,
     O_DB_TXN_DURABLE,
+    O_DB_SNAPSHOT_READS,
+    O_EARLY_EXIT_INTERVAL,
+    O_APPLY_DELTA,
+    O_BUILD_FILTER,
+    O_EXPORT_DELTA,
+    O_FOLD_JOURNAL,
     O_NS_ESF,
+    O_PRECOMPUTE,
     O_SP_ESF,
+    O_STATS_JSON,
     O_HAM_CUTOFF,
     O_HAM_TRUE,
     O_HEADER_FORMAT,
+    O_HEADER_ONLY,
+    O_JOURNAL_OVERLAY,
+    O_KEY_ENCODING,
     O_LOG_HEADER_FORMAT,
     O_LOG_UPDATE_FORMAT,
+    O_MAINT_CHUNK,
     O_MIN_DEV,
     O_MIN_TOKEN_LEN,
     O_MAX_TOKEN_LEN,
     O_MAX_MULTI_TOKEN_LEN,
+    O_MAX_MESSAGE_BYTES,
+    O_MAX_MESSAGE_TOKENS,
     O_MULTI_TOKEN_COUNT,
+    O_NEGATIVE_CACHE,
     O_REPLACE_NONASCII_CHARACTERS,
+    O_REPLICATION_LOG,
     O_ROBS,
     O_ROBX,
+    O_SCAN_THREADS,
     O_SPAM_CUTOFF,
     O_SPAM_HEADER_NAME,
     O_SPAM_HEADER_PLACE,
@@ -69,6 +86,7 @@ typedef enum longopts_e {
     O_TIMESTAMP,
     O_UNICODE,
     O_UNSURE_SUBJECT_TAG,
+    O_UPDATE_JOURNAL,
     O_USER_CONFIG_FILE,
     O_WORDLIST
 } longopts_t;
@@ -97,7 +115,14 @@ typedef enum longopts_e {
 
 /* options for bogofilter */
 #define LONGOPTIONS_MAIN \
-    { "ham-true"	,		N, 0, O_HAM_TRUE },
+    { "early-exit-interval",		R, 0, O_EARLY_EXIT_INTERVAL }, \
+    { "ham-true"	,		N, 0, O_HAM_TRUE }, \
+    { "header-only",			R, 0, O_HEADER_ONLY }, \
+    { "journal-overlay",		R, 0, O_JOURNAL_OVERLAY }, \
+    { "max-message-bytes",		R, 0, O_MAX_MESSAGE_BYTES }, \
+    { "max-message-tokens",		R, 0, O_MAX_MESSAGE_TOKENS }, \
+    { "stats-json",			N, 0, O_STATS_JSON }, \
+    { "update-journal",			R, 0, O_UPDATE_JOURNAL },
 
 /* options for bogofilter */
 #define LONGOPTIONS_MAIN_TUNE \
@@ -131,6 +156,10 @@ typedef enum longopts_e {
 
 #define LONGOPTIONS_DB \
     { "db-transaction",			R, 0, O_DB_TRANSACTION }, \
+    { "db-snapshot-reads",		R, 0, O_DB_SNAPSHOT_READS }, \
+    { "replication-log",		R, 0, O_REPLICATION_LOG }, \
+    { "negative-cache",			R, 0, O_NEGATIVE_CACHE }, \
+    { "key-encoding",			R, 0, O_KEY_ENCODING }, \
     { "timestamp-date",			R, 0, 'y' }, \
     lo1 lo2
 
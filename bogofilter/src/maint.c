@@ -11,7 +11,9 @@ AUTHOR:
 #include "common.h"
 
 #include <assert.h>
+#include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "buff.h"
 #include "datastore.h"
@@ -21,7 +23,10 @@ AUTHOR:
 #include "convert_unicode.h"
 #include "iconvert.h"
 #endif
+#include "delta.h"
+#include "journal.h"
 #include "maint.h"
+#include "prob.h"
 #include "transaction.h"
 #include "wordlists.h"
 #include "xmalloc.h"
@@ -33,6 +38,7 @@ size_t	 size_min = 0;
 size_t	 size_max = 0;
 bool     timestamp_tokens = true;
 bool	 upgrade_wordlist_version = false;
+uint	 maint_chunk = 0;	/* tokens per transaction, 0 for all at once */
 
 #ifndef	DISABLE_UNICODE
 e_enc	 old_encoding;
@@ -110,6 +116,17 @@ static void replace_token(const word_t *old_token, const word_t *new_token, cons
     set_date(0);
 }
 
+static bool has_prefix(const word_t *token, const char *prefix)
+{
+    size_t len = strlen(prefix);
+    return token->leng >= len && memcmp(token->u.text, prefix, len) == 0;
+}
+
+static bool is_maint_cursor(const word_t *token)
+{
+    return has_prefix(token, MAINT_CURSOR);
+}
+
 /* Keep token if at least one user given constraint should be kept */
 /* Discard if all user given constraints are satisfied */
 
@@ -124,6 +141,20 @@ bool discard_token(word_t *token, const dsv_t *in_val)
 	    return false;
 	if (0 == word_cmps(token, WORDLIST_ENCODING))
 	    return false;
+	if (0 == word_cmps(token, KEY_ENCODING))
+	    return false;
+	if (is_maint_cursor(token))
+	    return false;
+	/* the journal would be folded again from its start */
+	if (has_prefix(token, JOURNAL_TOKEN))
+	    return false;
+	/* replication state; its counts are small generation numbers */
+	if (has_prefix(token, REPLOG_TOKEN) ||
+	    0 == word_cmps(token, REPLOG_END) ||
+	    has_prefix(token, REPL_APPLIED) ||
+	    0 == word_cmps(token, REPL_NODE) ||
+	    0 == word_cmps(token, REPL_GENERATION))
+	    return false;
     }
 
     discard = (thresh_count != 0) || (thresh_date != 0) || (size_min != 0) || (size_max != 0);
@@ -177,6 +208,9 @@ static ex_t maintain_hook(word_t *w_key, dsv_t *in_val,
 	    strncmp((char *)token.u.text, MSG_COUNT, token.leng) == 0)
 	return EX_OK;
 
+    if (is_maint_cursor(&token))
+	return EX_OK;
+
     if (discard_token(&token, in_val)) {
 	ex_t ret = ta_delete(transaction, vhandle, &token) ? EX_ERROR : EX_OK;
 	if (DEBUG_DATABASE(0))
@@ -275,34 +309,33 @@ static bool check_wordlist_version(dsh_t *dsh)
 	return false;
 }
 
-static ex_t maintain_wordlist(void *database)
+static void init_encodings(void *database)
 {
-    ta_t *transaction = ta_init();
-    struct userdata_t userdata;
-    ex_t ret;
-    bool done = false;
-
-    userdata.vhandle = database;
-    userdata.transaction = transaction;
-
-    if (DST_OK == ds_txn_begin(database)) {
 #ifndef	DISABLE_UNICODE
-	dsv_t val;
-	int rc = ds_get_wordlist_encoding(database, &val);
-	new_encoding = encoding;
-	if (rc == 0)
-	    old_encoding = (e_enc)val.spamcount;	/* found | FIXME: is the cast correct? */
-	else
-	    old_encoding = E_RAW;		/* not found */
-	if (old_encoding != new_encoding) {
-	    const char *from_charset = DEFAULT_OR_UNICODE(old_encoding);
-	    const char *to_charset   = DEFAULT_OR_UNICODE(new_encoding);
-	    init_charset_table_iconv(from_charset, to_charset);
-	}
+    dsv_t val;
+    int rc = ds_get_wordlist_encoding(database, &val);
+    new_encoding = encoding;
+    if (rc == 0)
+	old_encoding = (e_enc)val.spamcount;	/* found | FIXME: is the cast correct? */
+    else
+	old_encoding = E_RAW;		/* not found */
+    /* chunked maintenance converts only if --unicode asks for it */
+    if (maint_chunk != 0 && new_encoding == E_UNKNOWN)
+	new_encoding = old_encoding;
+    if (old_encoding != new_encoding) {
+	const char *from_charset = DEFAULT_OR_UNICODE(old_encoding);
+	const char *to_charset   = DEFAULT_OR_UNICODE(new_encoding);
+	init_charset_table_iconv(from_charset, to_charset);
+    }
+#else
+    (void)database;
 #endif
-	ret = ds_foreach(database, maintain_hook, &userdata);
-    } else
-	ret = EX_ERROR;
+}
+
+/* update .WORDLIST_VERSION and .ENCODING once all tokens are done */
+static void update_wordlist_info(void *database)
+{
+    bool done = false;
 
     if (upgrade_wordlist_version) {
 	done = check_wordlist_version((dsh_t *)database);
@@ -335,6 +368,24 @@ static ex_t maintain_wordlist(void *database)
 	xfree(enco.u.text);
     }
 #endif
+}
+
+static ex_t maintain_wordlist(void *database)
+{
+    ta_t *transaction = ta_init();
+    struct userdata_t userdata;
+    ex_t ret;
+
+    userdata.vhandle = database;
+    userdata.transaction = transaction;
+
+    if (DST_OK == ds_txn_begin(database)) {
+	init_encodings(database);
+	ret = ds_foreach(database, maintain_hook, &userdata);
+    } else
+	ret = EX_ERROR;
+
+    update_wordlist_info(database);
 
     if (ta_commit(transaction) != TA_OK)
 	ret = EX_ERROR;
@@ -345,6 +396,270 @@ static ex_t maintain_wordlist(void *database)
     return ret;
 }
 
+/* With --scan-threads, maintenance that only discards tokens first
+** looks for them with concurrent readers, then deletes them in one
+** transaction, checking each again in case it changed meanwhile.
+*/
+
+struct discard_t {
+    word_t **words;
+    uint count;
+    uint size;
+};
+
+static void discard_grow(struct discard_t *d, uint count)
+{
+    if (count <= d->size)
+	return;
+    while (d->size < count)
+	d->size = d->size ? d->size * 2 : 256;
+    d->words = (word_t **)xrealloc(d->words, d->size * sizeof(word_t *));
+}
+
+static ex_t discard_hook(word_t *w_key, dsv_t *in_val, void *userdata)
+{
+    struct discard_t *d = (struct discard_t *) userdata;
+
+    if (is_maint_cursor(w_key) || !discard_token(w_key, in_val))
+	return EX_OK;
+
+    discard_grow(d, d->count + 1);
+    d->words[d->count++] = word_dup(w_key);
+
+    return EX_OK;
+}
+
+static void discard_merge(void *userdata, void *part)
+{
+    struct discard_t *d = (struct discard_t *) userdata;
+    struct discard_t *dp = (struct discard_t *) part;
+
+    discard_grow(d, d->count + dp->count);
+    if (dp->count != 0)
+	memcpy(d->words + d->count, dp->words, dp->count * sizeof(word_t *));
+    d->count += dp->count;
+    xfree(dp->words);
+}
+
+/* true if -m does nothing but discard tokens */
+static bool prune_only(void)
+{
+    return !replace_nonascii_characters && !upgrade_wordlist_version
+	&& encoding == E_UNKNOWN;
+}
+
+static ex_t prune_wordlist_parallel(void *database)
+{
+    ta_t *transaction = ta_init();
+    struct discard_t d;
+    ex_t ret;
+    uint i;
+
+    memset(&d, 0, sizeof(d));
+
+    if (DST_OK != ds_txn_begin(database)) {
+	ta_rollback(transaction);
+	return EX_ERROR;
+    }
+
+    ret = ds_foreach_parallel(database, scan_threads, discard_hook, &d, sizeof(d),
+			      discard_merge);
+
+    for (i = 0; i < d.count; i += 1) {
+	word_t *token = d.words[i];
+	dsv_t val;
+	int rc = (ret == EX_OK) ? ds_read(database, token, &val) : DS_NOTFOUND;
+
+	if (rc != 0 && rc != DS_NOTFOUND)
+	    ret = EX_ERROR;
+	else if (rc == 0 && discard_token(token, &val)) {
+	    if (DEBUG_DATABASE(0))
+		fprintf(dbgout, "deleting '%.*s'\n", (int)min(INT_MAX, token->leng), (char *)token->u.text);
+	    if (ta_delete(transaction, database, token) != TA_OK)
+		ret = EX_ERROR;
+	}
+	word_free(token);
+    }
+    xfree(d.words);
+
+    if (ret == EX_OK) {
+	if (ta_commit(transaction) != TA_OK)
+	    ret = EX_ERROR;
+    }
+    else
+	ta_rollback(transaction);
+
+    if (DST_OK != (ret == EX_OK ? ds_txn_commit(database) : ds_txn_abort(database)))
+	ret = EX_ERROR;
+
+    return ret;
+}
+
+/* Chunked maintenance (--maint-chunk) walks the wordlist in key order,
+** maint_chunk tokens per transaction, and closes the wordlist between
+** chunks, so that registering messages needn't wait for the whole
+** walk.  After each chunk the last token done is saved in the key of a
+** MAINT_CURSOR record; an interrupted run continues from there.  The
+** values of the wordlist only hold counts, so the token is in the key,
+** in hex: that is plain ASCII, which key_encoding leaves alone, so the
+** record is the first key after MAINT_CURSOR whatever the token.
+*/
+
+static ex_t find_cursor_hook(word_t *w_key, dsv_t *in_val, void *userdata)
+{
+    word_t **cursor = (word_t **) userdata;
+
+    (void)in_val;
+    if (is_maint_cursor(w_key))
+	*cursor = word_dup(w_key);
+    return EX_OK;
+}
+
+/* returns the MAINT_CURSOR record, or NULL if there is none */
+static word_t *read_cursor(void *database)
+{
+    word_t *prefix = word_news(MAINT_CURSOR);
+    word_t *cursor = NULL;
+    word_t *last = NULL;
+
+    /* the record, if any, is the first key after the bare prefix */
+    (void)ds_foreach_chunk(database, prefix, 1, find_cursor_hook, &cursor, &last);
+
+    word_free(last);
+    word_free(prefix);
+    return cursor;
+}
+
+static const char hex_digits[] = "0123456789abcdef";
+
+/* the token of the MAINT_CURSOR record, or NULL if it is malformed */
+static word_t *cursor_token(const word_t *cursor)
+{
+    size_t len = strlen(MAINT_CURSOR);
+    uint hex = cursor->leng - len;
+    word_t *token;
+    uint i;
+
+    if (hex % 2 != 0)
+	return NULL;
+
+    token = word_new(NULL, hex / 2);
+    for (i = 0; i < hex; i += 1) {
+	const char *d = (cursor->u.text[len + i] != '\0')
+	    ? strchr(hex_digits, cursor->u.text[len + i]) : NULL;
+	if (d == NULL) {
+	    word_free(token);
+	    return NULL;
+	}
+	if (i % 2 == 0)
+	    token->u.text[i / 2] = (byte) ((d - hex_digits) << 4);
+	else
+	    token->u.text[i / 2] |= (byte) (d - hex_digits);
+    }
+
+    return token;
+}
+
+static int write_cursor(void *database, const word_t *last)
+{
+    size_t len = strlen(MAINT_CURSOR);
+    word_t *cursor = word_new(NULL, len + 2 * last->leng);
+    dsv_t val;
+    uint i;
+    int rc;
+
+    memcpy(cursor->u.text, MAINT_CURSOR, len);
+    for (i = 0; i < last->leng; i += 1) {
+	cursor->u.text[len + 2 * i]     = hex_digits[last->u.text[i] >> 4];
+	cursor->u.text[len + 2 * i + 1] = hex_digits[last->u.text[i] & 0xf];
+    }
+    memset(&val, 0, sizeof(val));
+
+    rc = ds_write(database, cursor, &val);
+    word_free(cursor);
+    return rc;
+}
+
+/* do one chunk, set *done once the end of the wordlist is reached */
+static ex_t maintain_chunk(void *database, bool *done)
+{
+    ta_t *transaction = ta_init();
+    struct userdata_t userdata;
+    word_t *cursor;
+    word_t *after = NULL;
+    word_t *last = NULL;
+    ex_t ret;
+
+    userdata.vhandle = database;
+    userdata.transaction = transaction;
+
+    if (DST_OK != ds_txn_begin(database)) {
+	ta_rollback(transaction);
+	return EX_ERROR;
+    }
+
+    init_encodings(database);
+#ifndef	DISABLE_UNICODE
+    /* converted tokens may sort after the cursor and be converted again */
+    if (old_encoding != new_encoding) {
+	fprintf(stderr, "%s: can't change the wordlist encoding with --maint-chunk.\n",
+		progname);
+	ta_rollback(transaction);
+	(void)ds_txn_abort(database);
+	return EX_ERROR;
+    }
+#endif
+
+    /* a malformed cursor starts the walk over */
+    cursor = read_cursor(database);
+    if (cursor != NULL)
+	after = cursor_token(cursor);
+
+    ret = ds_foreach_chunk(database, after, maint_chunk,
+			   maintain_hook, &userdata, &last);
+
+    /* the cursor record is no position: its successor may sort after
+     * it, and be reached again and again */
+    while (ret == EX_OK && last != NULL && is_maint_cursor(last)) {
+	word_t *skip = last;
+	last = NULL;
+	ret = ds_foreach_chunk(database, skip, 1, maintain_hook, &userdata, &last);
+	word_free(skip);
+    }
+
+    if (ret == EX_OK) {
+	if (ta_commit(transaction) != TA_OK)
+	    ret = EX_ERROR;
+    }
+    else
+	ta_rollback(transaction);
+
+    if (ret == EX_OK) {
+	if (cursor != NULL && ds_delete(database, cursor) != 0)
+	    ret = EX_ERROR;
+	if (last != NULL) {
+	    if (write_cursor(database, last) != 0)
+		ret = EX_ERROR;
+	} else {
+	    update_wordlist_info(database);
+	    *done = true;
+	}
+    }
+
+    if (DEBUG_DATABASE(0) && last != NULL)
+	fprintf(dbgout, "chunk done up to '%.*s'\n",
+		(int)min(INT_MAX, last->leng), (char *)last->u.text);
+
+    word_free(last);
+    word_free(after);
+    word_free(cursor);
+
+    if (DST_OK != (ret == EX_OK ? ds_txn_commit(database) : ds_txn_abort(database)))
+	ret = EX_ERROR;
+
+    return ret;
+}
+
 ex_t maintain_wordlist_file(bfpath *bfp)
 {
     ex_t rc;
@@ -353,12 +668,156 @@ ex_t maintain_wordlist_file(bfpath *bfp)
 
     dbe = ds_init(bfp);
 
+    if (maint_chunk != 0) {
+	bool done = false;
+
+	/* reopen for each chunk, to release the locks in between */
+	for (rc = EX_OK; rc == EX_OK && !done; ) {
+	    dsh = (dsh_t *)ds_open(dbe, bfp, DS_WRITE);
+	    if (dsh == NULL) {
+		rc = EX_ERROR;
+		break;
+	    }
+	    rc = maintain_chunk(dsh, &done);
+	    ds_close(dsh);
+	}
+
+	ds_cleanup(dbe);
+	return rc;
+    }
+
+    dsh = (dsh_t *)ds_open(dbe, bfp, DS_WRITE);
+
+    if (dsh == NULL) {
+	ds_cleanup(dbe);
+	return EX_ERROR;
+    }
+
+    if (scan_threads > 1 && prune_only())
+	rc = prune_wordlist_parallel(dsh);
+    else
+	rc = maintain_wordlist(dsh);
+
+    ds_close(dsh);
+    ds_cleanup(dbe);
+
+    return rc;
+}
+
+/* Store each token's probability for the current robs, robx and
+** message counts.  Classification uses it while the generation
+** matches; any later update of the token drops it.
+*/
+
+struct precompute_t {
+    void *vhandle;
+    ta_t *transaction;
+    u_int32_t msgcount[IX_SIZE];
+    u_int32_t gen;
+    uint count;
+};
+
+static ex_t precompute_hook(word_t *w_key, dsv_t *in_val,
+	void *userdata)
+{
+    struct precompute_t *pc = (struct precompute_t *) userdata;
+    dsv_t val;
+    double prob;
+
+    /* skip special tokens, e.g. .MSG_COUNT and .ROBX */
+    if (w_key->leng != 0 && w_key->u.text[0] == '.')
+	return EX_OK;
+
+    if (in_val->prob_gen == pc->gen)	/* already current */
+	return EX_OK;
+
+    prob = calc_prob(in_val->goodcount, in_val->spamcount,
+		     pc->msgcount[IX_GOOD], pc->msgcount[IX_SPAM]);
+
+    memcpy(&val, in_val, sizeof(val));
+    val.prob_gen = pc->gen;
+    val.prob = prob_quantize(prob);
+    pc->count += 1;
+
+    return ta_write_prob(pc->transaction, pc->vhandle, w_key, &val) ? EX_ERROR : EX_OK;
+}
+
+static ex_t precompute_wordlist(void *database)
+{
+    struct precompute_t pc;
+    dsv_t val;
+    ex_t ret;
+
+    pc.vhandle = database;
+    pc.transaction = ta_init();
+    pc.count = 0;
+
+    if (DST_OK != ds_txn_begin(database)) {
+	ta_rollback(pc.transaction);
+	return EX_ERROR;
+    }
+
+    /* same defaults as score_initialize() */
+    if (fabs(robs) < EPS)
+	robs = ROBS;
+
+    if (fabs(robx) < EPS) {
+	word_t *word_robx = word_news(ROBX_W);
+	robx = ROBX;
+	if (ds_read(database, word_robx, &val) == 0 && val.spamcount != 0)
+	    robx = (double)val.spamcount / 1000000;
+	word_free(word_robx);
+    }
+
+    if (ds_get_msgcounts(database, &val) != 0)
+	val.goodcount = val.spamcount = 0;
+    pc.msgcount[IX_GOOD] = val.goodcount;
+    pc.msgcount[IX_SPAM] = val.spamcount;
+    pc.gen = prob_generation(pc.msgcount[IX_GOOD], pc.msgcount[IX_SPAM]);
+
+    ret = ds_foreach(database, precompute_hook, &pc);
+
+    /* the records with a probability are longer than older versions
+     * of bogofilter expect */
+    if (ret == EX_OK &&
+	(ds_get_wordlist_version(database, &val) != 0 || val.count[0] < PROB_RECORDS)) {
+	memset(&val, 0, sizeof(val));
+	val.count[0] = PROB_RECORDS;
+	if (ds_set_wordlist_version(database, &val) != 0)
+	    ret = EX_ERROR;
+    }
+
+    if (ret == EX_OK) {
+	if (ta_commit(pc.transaction) != TA_OK)
+	    ret = EX_ERROR;
+    }
+    else
+	ta_rollback(pc.transaction);
+
+    if (DST_OK != (ret == EX_OK ? ds_txn_commit(database) : ds_txn_abort(database)))
+	ret = EX_ERROR;
+
+    if (ret == EX_OK && verbose)
+	fprintf(dbgout, "%u tokens precomputed, robs %f, robx %f, generation %08lx\n",
+		pc.count, robs, robx, (unsigned long)pc.gen);
+
+    return ret;
+}
+
+ex_t precompute_wordlist_file(bfpath *bfp)
+{
+    ex_t rc;
+    dsh_t *dsh;
+    void *dbe;
+
+    dbe = ds_init(bfp);
+
     dsh = (dsh_t *)ds_open(dbe, bfp, DS_WRITE);
 
     if (dsh == NULL)
 	return EX_ERROR;
 
-    rc = maintain_wordlist(dsh);
+    rc = precompute_wordlist(dsh);
 
     ds_close(dsh);
     ds_cleanup(dbe);
@@ -16,9 +16,15 @@ extern	size_t   size_min, size_max;
 extern	bool     timestamp_tokens;
 extern	bool     replace_nonascii_characters;
 extern	bool     upgrade_wordlist_version;
+extern	uint     maint_chunk;
+
+/* Key prefix of the record in which chunked maintenance saves its
+ * position; the rest of the key is the last token done, in hex. */
+#define	MAINT_CURSOR	".MAINT_CURSOR:"
 
 /* Function Prototypes */
 ex_t maintain_wordlist_file(bfpath *bfp);
+ex_t precompute_wordlist_file(bfpath *bfp);
 
 bool discard_token(word_t *token, const dsv_t *val);
 
@@ -71,6 +71,24 @@ static const struct disposition_s {
     { MIME_ATTACHMENT,	"attachment" },
 };
 
+/** summary tokens of skipped parts, handed out by mime_summary().
+ * The array grows with the number of parts of a message and is freed
+ * by mime_cleanup(). */
+#define	SUMMARY_INIT	12
+#define	SUMMARY_LEN	64
+
+static char (*summary)[SUMMARY_LEN] = NULL;
+static uint summary_max = 0;
+static uint summary_cnt = 0;
+static uint summary_pos = 0;
+
+/** boundaries of the MIME stack, hashed, so that a line is checked
+ * with one lookup per possible boundary length instead of a walk of
+ * the whole stack */
+#define	BOUNDARY_BUCKETS	64
+
+static mime_t *boundary_table[BOUNDARY_BUCKETS];
+
 /** properties of a MIME boundary */
 typedef struct {
     bool is_valid;	/**< valid boundary of an enclosing MIME container */
@@ -86,6 +104,7 @@ static void mime_type(word_t * text);
 
 static void mime_push(mime_t * parent);
 static void mime_pop(void);
+static bool is_mime_container(mime_t * m);
 
 /* Function Definitions */
 
@@ -152,18 +171,80 @@ static void mime_stack_dump(void)
 }
 #endif
 
+/** FNV-1a, continued from \a h over \a len bytes at \a buf */
+static u_int32_t boundary_hash(u_int32_t h, const byte *buf, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i += 1) {
+	h ^= buf[i];
+	h *= 16777619u;
+    }
+
+    return h;
+}
+
+#define	BOUNDARY_HASH_INIT	2166136261u
+
+static void boundary_table_add(mime_t * t)
+{
+    mime_t **head;
+
+    t->boundary_hash = boundary_hash(BOUNDARY_HASH_INIT,
+				     (const byte *) t->boundary, t->boundary_len);
+    head = &boundary_table[t->boundary_hash % BOUNDARY_BUCKETS];
+    t->boundary_next = *head;
+    *head = t;
+}
+
+static void boundary_table_remove(mime_t * t)
+{
+    mime_t **p = &boundary_table[t->boundary_hash % BOUNDARY_BUCKETS];
+
+    for (; *p != NULL; p = &(*p)->boundary_next) {
+	if (*p == t) {
+	    *p = t->boundary_next;
+	    break;
+	}
+    }
+    t->boundary_next = NULL;
+}
+
+/** \return the deepest container whose boundary is the \a len bytes
+ * at \a buf, hashing to \a h, or \a best if that is deeper */
+static mime_t *boundary_table_find(mime_t * best, u_int32_t h,
+				   const byte *buf, size_t len)
+{
+    mime_t *t;
+
+    for (t = boundary_table[h % BOUNDARY_BUCKETS]; t != NULL; t = t->boundary_next) {
+	if (t->boundary_hash == h
+	    && t->boundary_len == len
+	    && (best == NULL || t->depth > best->depth)
+	    && is_mime_container(t)
+	    && memcmp(t->boundary, buf, len) == 0)
+	    best = t;
+    }
+
+    return best;
+}
+
 static void mime_init(mime_t * parent)
 {
     msg_state->mime_type = MIME_TEXT;
     msg_state->mime_encoding = MIME_7BIT;
     msg_state->boundary = NULL;
     msg_state->boundary_len = 0;
+    msg_state->boundary_next = NULL;
     msg_state->parent = parent;
     msg_state->charset = xstrdup("US-ASCII");
     msg_state->depth = (parent == NULL) ? 0 : msg_state->parent->depth + 1;
     msg_state->child  = NULL;
     msg_state->mime_dont_decode = false;
     msg_state->mime_disposition = MIME_DISPOSITION_UNKNOWN;
+    msg_state->type_name = NULL;
+    msg_state->file_ext = NULL;
+    msg_state->skipped = 0;
 
     if (parent)
 	parent->child = msg_state;
@@ -183,6 +264,7 @@ static void mime_free(mime_t * t)
 	mime_stack_top = t->child;
 
     if (t->boundary) {
+	boundary_table_remove(t);
 	xfree(t->boundary);
 	t->boundary = NULL;
     }
@@ -192,6 +274,9 @@ static void mime_free(mime_t * t)
 	t->charset = NULL;
     }
 
+    xfree(t->type_name);
+    xfree(t->file_ext);
+
     t->parent = NULL;
 
     xfree(t);
@@ -218,6 +303,10 @@ void mime_cleanup()
 
     mime_stack_top = NULL;
     mime_stack_bot = NULL;
+
+    xfree(summary);
+    summary = NULL;
+    summary_max = summary_cnt = summary_pos = 0;
 }
 
 static void mime_push(mime_t * parent)
@@ -238,6 +327,38 @@ static void mime_push(mime_t * parent)
 	mime_stack_dump();
 }
 
+static void summary_add(const char *kind, const char *text)
+{
+    if (summary_cnt == summary_max) {
+	summary_max = summary_max ? 2 * summary_max : SUMMARY_INIT;
+	summary = (char (*)[SUMMARY_LEN])xrealloc(summary, summary_max * sizeof(summary[0]));
+    }
+    snprintf(summary[summary_cnt], SUMMARY_LEN, "spc:%s:%s", kind, text);
+    summary_cnt += 1;
+}
+
+/** queue the summary tokens of part \a t if its body was skipped:
+ * media type, size rounded up to a power of two, file extension */
+static void mime_summarize(mime_t * t)
+{
+    size_t bucket = 1;
+    char size[24];
+
+    if (t->skipped == 0)
+	return;
+
+    while (bucket < t->skipped)
+	bucket *= 2;
+    snprintf(size, sizeof(size), "%lu", (unsigned long) bucket);
+
+    summary_add("type", t->type_name ? t->type_name : "unknown");
+    summary_add("size", size);
+    if (t->file_ext)
+	summary_add("ext", t->file_ext);
+
+    t->skipped = 0;
+}
+
 static void mime_pop(void)
 {
     if (DEBUG_MIME(1))
@@ -247,6 +368,8 @@ static void mime_pop(void)
     {
 	mime_t *parent = msg_state->parent;
 
+	mime_summarize(msg_state);
+
 	mime_free(msg_state);
 
 	msg_state = parent;
@@ -281,6 +404,8 @@ void mime_reset(void)
 
     mime_cleanup();
 
+    summary_cnt = summary_pos = 0;
+
     mime_push(NULL);
 }
 
@@ -322,7 +447,7 @@ static bool is_final_boundary(
 static bool get_boundary_props(const word_t * boundary, /**< input line */
 	boundary_t * b /*@out@*/ /**< output properties, must be pre-allocated by caller */)
 {
-    mime_t *ptr;
+    mime_t *ptr = NULL;
     const byte *buf = boundary->u.text;
     size_t blen = boundary->leng;
 
@@ -330,26 +455,28 @@ static bool get_boundary_props(const word_t * boundary, /**< input line */
 
     /* a boundary line must begin with two dashes */
     if (blen > 2 && buf[0] == '-' && buf[1] == '-') {
+	u_int32_t h = BOUNDARY_HASH_INIT;
 
 	/* strip EOL characters */
 	while (blen > 2 &&
 	       (buf[blen - 1] == '\r' || buf[blen - 1] == '\n'))
 	    blen--;
 
-	/* search stack for matching boundary, in reverse order */
-	for (ptr = mime_stack_bot; ptr != NULL; ptr = ptr->parent)
-	{
-	    if (is_mime_container(ptr)
-		&& ptr->boundary != NULL
-		&& (ptr->boundary_len + 2 == blen
-		    || ptr->boundary_len + 4 == blen)
-		&& (memcmp(ptr->boundary, buf + 2, ptr->boundary_len) == 0))
-	    {
-		b->depth = ptr->depth;
-		b->is_valid = true;
-		b->is_final = is_final_boundary(buf, blen, ptr->boundary_len);
-		break;
-	    }
+	/* look up the line as "--boundary--" and as "--boundary",
+	 * the deepest matching container wins */
+	if (blen > 4) {
+	    h = boundary_hash(h, buf + 2, blen - 4);
+	    ptr = boundary_table_find(ptr, h, buf + 2, blen - 4);
+	    h = boundary_hash(h, buf + blen - 2, 2);
+	}
+	else
+	    h = boundary_hash(h, buf + 2, blen - 2);
+	ptr = boundary_table_find(ptr, h, buf + 2, blen - 2);
+
+	if (ptr != NULL) {
+	    b->depth = ptr->depth;
+	    b->is_valid = true;
+	    b->is_final = is_final_boundary(buf, blen, ptr->boundary_len);
 	}
     }
 
@@ -535,6 +662,7 @@ static void mime_type(word_t * text)
     const struct type_s *typ;
     const size_t l = sizeof("Content-Type:") - 1;
     byte *w = getword(text->u.text + l, text->u.text + text->leng);
+    byte *c;
 
     if (!w)
 	return;
@@ -551,7 +679,12 @@ static void mime_type(word_t * text)
     }
     if (DEBUG_MIME(0) && msg_state->mime_type == MIME_TYPE_UNKNOWN)
 	fprintf(stderr, "Unknown mime type - '%s'\n", w);
-    xfree(w);
+
+    /* keep the type for summary tokens */
+    xfree(msg_state->type_name);
+    msg_state->type_name = (char *) w;
+    for (c = w; *c != '\0'; c += 1)
+	*c = (byte) tolower(*c);
 
     switch (msg_state->mime_type) {
     case MIME_TEXT:		return;	/* XXX: read charset */
@@ -583,9 +716,13 @@ void mime_boundary_set(word_t * text)
     }
 
     boundary = getword(boundary + strlen("boundary="), boundary + blen);
-    xfree(msg_state->boundary);
+    if (msg_state->boundary) {
+	boundary_table_remove(msg_state);
+	xfree(msg_state->boundary);
+    }
     msg_state->boundary = (char *) boundary;
     msg_state->boundary_len = strlen((char *) boundary);
+    boundary_table_add(msg_state);
 
     if (DEBUG_MIME(1))
 	fprintf(dbgout, "*** <-- mime_boundary_set: %d '%s'\n",
@@ -639,3 +776,66 @@ enum mimetype get_content_type(void)
 {
     return msg_state->mime_type;
 }
+
+void mime_filename(word_t * text)
+{
+    const byte *t = (const byte *) memchr(text->u.text, '=', text->leng);
+    const byte *e = text->u.text + text->leng;
+    const byte *dot = NULL;
+    size_t l, i;
+
+    if (t == NULL)
+	return;
+
+    t += 1;
+    if (t < e && *t == '"')
+	t += 1;
+
+    /* the extension is what follows the last dot of the name */
+    for (; t < e && *t != '"' && *t != ';' && *t != '\r' && *t != '\n'; t += 1) {
+	if (*t == '.')
+	    dot = t;
+    }
+    if (dot == NULL)
+	return;
+
+    l = t - (dot + 1);
+    if (l == 0 || l > 8)
+	return;
+
+    for (i = 0; i < l; i += 1) {
+	if (!isalnum(dot[1 + i]))
+	    return;
+    }
+
+    xfree(msg_state->file_ext);
+    msg_state->file_ext = (char *) xmalloc(l + 1);
+    for (i = 0; i < l; i += 1)
+	msg_state->file_ext[i] = (char) tolower(dot[1 + i]);
+    msg_state->file_ext[l] = '\0';
+}
+
+void mime_skipped(size_t len)
+{
+    msg_state->skipped += len;
+}
+
+bool mime_summary(word_t * token, bool eom)
+{
+    if (eom) {
+	mime_t *t;
+	for (t = msg_state; t != NULL; t = t->parent)
+	    mime_summarize(t);
+    }
+
+    if (summary_pos >= summary_cnt) {
+	summary_cnt = summary_pos = 0;
+	return false;
+    }
+
+    token->u.text = (byte *) summary[summary_pos];
+    token->leng = (uint) strlen(summary[summary_pos]);
+    summary_pos += 1;
+
+    return true;
+}
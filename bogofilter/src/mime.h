@@ -46,10 +46,15 @@ struct mime_t {
     char *boundary;	/**< only valid if mime_type is
 			  MIME_MULTIPART or MIME_MESSAGE */
     size_t boundary_len;
+    u_int32_t boundary_hash;	/**< hash of boundary, for boundary_table */
+    mime_t *boundary_next;	/**< next in boundary_table chain */
     enum mimetype mime_type;
     bool mime_dont_decode;
     enum mimeencoding mime_encoding;
     enum mimedisposition mime_disposition;
+    char *type_name;	/**< media type, for summary tokens */
+    char *file_ext;	/**< file name extension, for summary tokens */
+    size_t skipped;	/**< body bytes read without tokenizing */
     mime_t *parent;
     mime_t *child;	/* for mime_stack_dump() */
 };
@@ -85,6 +90,20 @@ bool mime_is_boundary(word_t *boundary);
 /** \return current mime_type */
 enum mimetype get_content_type(void);
 
+/** Note the file name parameter in \a text ("name=..." or
+ *  "filename=...") for the current part's summary tokens */
+void mime_filename(word_t *text);
+
+/** Count \a len body bytes of the current part that were read without
+ *  decoding or tokenizing them */
+void mime_skipped(size_t len);
+
+/** Set \a token to the next summary token (type, size bucket and file
+ *  name extension) of a part whose body was skipped.  With \a eom,
+ *  the parts still open at the end of the message are included.
+ *  \return false if there is none */
+bool mime_summary(word_t *token, bool eom);
+
 /** pop all elements from the MIME stack and reinitialize */
 void mime_cleanup(void);
 
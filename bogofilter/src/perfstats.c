@@ -0,0 +1,128 @@
+/*****************************************************************************
+
+NAME:
+   perfstats.c -- per-phase timing and counters for classification.
+
+******************************************************************************/
+
+#include "common.h"
+
+#include "perfstats.h"
+
+bool perfstats_enabled = false;
+
+typedef struct {
+    unsigned long messages;
+    double	  time[PH_COUNT];	/* seconds */
+    unsigned long count[PC_COUNT];
+} perfstats_t;
+
+static perfstats_t msg;			/* current message */
+static perfstats_t total;		/* all messages so far */
+
+static phase_t	cur_phase = PH_OTHER;
+static double	cur_since = -1.0;	/* < 0: clock not started */
+
+static const char *phase_names[PH_COUNT] = {
+    "other", "read", "lex", "collect", "lookup", "score", "register", "output",
+    "lock_wait"
+};
+
+static const char *counter_names[PC_COUNT] = {
+    "tokens", "bytes", "prob_cache_hits", "prob_cache_misses",
+    "ds_retries", "lock_waits", "filter_negatives", "filter_false_positives"
+};
+
+double perfstats_now(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+    {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+    }
+}
+
+phase_t perfstats_enter(phase_t ph)
+{
+    phase_t prev = cur_phase;
+    double t = perfstats_now();
+
+    if (cur_since >= 0.0)
+	msg.time[cur_phase] += t - cur_since;
+    cur_since = t;
+    cur_phase = ph;
+
+    return prev;
+}
+
+void perfstats_leave(phase_t prev)
+{
+    (void) perfstats_enter(prev);
+}
+
+void perfstats_count(pcounter_t pc, unsigned long n)
+{
+    msg.count[pc] += n;
+}
+
+static void print_json(FILE *fp, const char *kind, const perfstats_t *ps)
+{
+    int i;
+
+    fprintf(fp, "{\"%s\":%lu,\"time_us\":{", kind, ps->messages);
+    for (i = 0; i < PH_COUNT; i += 1)
+	fprintf(fp, "%s\"%s\":%.0f", i ? "," : "", phase_names[i], ps->time[i] * 1e6);
+    fprintf(fp, "},\"counts\":{");
+    for (i = 0; i < PC_COUNT; i += 1)
+	fprintf(fp, "%s\"%s\":%lu", i ? "," : "", counter_names[i], ps->count[i]);
+    fprintf(fp, "}");
+    /* of the lookups of absent tokens, the share the filter passed on */
+    if (ps->count[PC_FILTER_NEGATIVES] + ps->count[PC_FILTER_FALSE_POS] != 0)
+	fprintf(fp, ",\"filter_fp_rate\":%.4f",
+		(double) ps->count[PC_FILTER_FALSE_POS] /
+		(ps->count[PC_FILTER_NEGATIVES] + ps->count[PC_FILTER_FALSE_POS]));
+    fprintf(fp, "}\n");
+}
+
+/* charge the time up to now and add the current figures to the totals */
+static void msg_add_to_total(void)
+{
+    int i;
+
+    if (cur_since >= 0.0)
+	perfstats_leave(cur_phase);
+
+    for (i = 0; i < PH_COUNT; i += 1)
+	total.time[i] += msg.time[i];
+    for (i = 0; i < PC_COUNT; i += 1)
+	total.count[i] += msg.count[i];
+
+    memset(&msg, 0, sizeof(msg));
+}
+
+void perfstats_msg_end(FILE *fp, bool print)
+{
+    total.messages += 1;
+    msg.messages = total.messages;
+
+    if (print) {
+	if (cur_since >= 0.0)
+	    perfstats_leave(cur_phase);
+	print_json(fp, "message", &msg);
+    }
+
+    msg_add_to_total();
+}
+
+/* work after the last message, such as registering the words of all
+ * messages at once, is counted in the totals only */
+void perfstats_print_totals(FILE *fp)
+{
+    msg_add_to_total();
+    print_json(fp, "messages", &total);
+}
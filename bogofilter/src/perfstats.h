@@ -0,0 +1,67 @@
+/*****************************************************************************
+
+NAME:
+   perfstats.h -- per-phase timing and counters for classification.
+
+******************************************************************************/
+
+#ifndef PERFSTATS_H
+#define PERFSTATS_H
+
+/* Time is charged to one phase at a time: entering a phase stops the
+ * clock of the one it interrupts, so the phase times of a message add
+ * up to its elapsed time.  Reading, for instance, happens while lexing,
+ * and lexing while collecting words; each gets only its own share. */
+typedef enum {
+    PH_OTHER,		/* not in any of the phases below */
+    PH_READ,		/* reading input lines */
+    PH_LEX,		/* decoding and tokenizing */
+    PH_COLLECT,		/* collect_words(), apart from reading and lexing */
+    PH_LOOKUP,		/* lookup_words(): reading the wordlists */
+    PH_SCORE,		/* computing the spamicity */
+    PH_REGISTER,	/* register_words(): updating the wordlists */
+    PH_OUTPUT,		/* passthrough and log output */
+    PH_LOCK_WAIT,	/* sleeping while another process holds a lock */
+    PH_COUNT
+} phase_t;
+
+typedef enum {
+    PC_TOKENS,		/* tokens returned by get_token() */
+    PC_BYTES,		/* bytes of input read */
+    PC_PROB_HITS,	/* token probabilities found in the cache */
+    PC_PROB_MISSES,	/* token probabilities computed */
+    PC_DS_RETRIES,	/* operations retried after DS_ABORT_RETRY */
+    PC_LOCK_WAITS,	/* waits for a locked wordlist */
+    PC_FILTER_NEGATIVES,	/* lookups the negative cache answered */
+    PC_FILTER_FALSE_POS,	/* lookups it passed on, of absent tokens */
+    PC_COUNT
+} pcounter_t;
+
+extern bool perfstats_enabled;	/* --stats-json */
+
+/** A monotonic clock, in seconds, for timing in bogofilter and its
+ * benchmarks. */
+double perfstats_now(void);
+
+/** Start charging time to \a ph, return the phase it interrupts. */
+phase_t perfstats_enter(phase_t ph);
+
+/** Go back to phase \a prev, as returned by perfstats_enter(). */
+void perfstats_leave(phase_t prev);
+
+void perfstats_count(pcounter_t pc, unsigned long n);
+
+/** Add the current message to the totals and, if \a print, write its
+ * figures to \a fp as a line of JSON. */
+void perfstats_msg_end(FILE *fp, bool print);
+
+/** Write the totals of all messages to \a fp as a line of JSON. */
+void perfstats_print_totals(FILE *fp);
+
+/* Used on per-line and per-token paths; no calls without --stats-json. */
+#define PERFSTATS_ENTER(ph)	(perfstats_enabled ? perfstats_enter(ph) : PH_OTHER)
+#define PERFSTATS_PHASE(ph)	do { if (perfstats_enabled) (void) perfstats_enter(ph); } while (0)
+#define PERFSTATS_LEAVE(prev)	do { if (perfstats_enabled) perfstats_leave(prev); } while (0)
+#define PERFSTATS_COUNT(pc, n)	do { if (perfstats_enabled) perfstats_count(pc, n); } while (0)
+
+#endif	/* PERFSTATS_H */
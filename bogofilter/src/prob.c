@@ -10,9 +10,31 @@ AUTHORS:
 ******************************************************************************/
 
 #include "globals.h"
+#include "perfstats.h"
 #include "prob.h"
 
-double calc_prob(uint good, uint bad, uint goodmsgs, uint badmsgs)
+/* calc_prob() is a pure function of its arguments plus robs and robx.
+** Most tokens have low counts, so results for counts below MEMO_CNT
+** are kept in a direct-mapped table.  Entries are valid only for the
+** generation matching the current robs, robx and message counts; a
+** change to any of them starts a new generation.
+*/
+
+#define	MEMO_CNT	32
+
+typedef struct memo_s {
+    uint	gen;
+    double	prob;
+} memo_t;
+
+static memo_t	memo[MEMO_CNT][MEMO_CNT];
+static uint	memo_gen;		/* 0 is never valid */
+static uint	memo_goodmsgs;
+static uint	memo_badmsgs;
+static double	memo_robs;
+static double	memo_robx;
+
+double calc_prob_uncached(uint good, uint bad, uint goodmsgs, uint badmsgs)
 {
     uint n = good + bad;
     double fw, pw;
@@ -49,3 +71,75 @@ double calc_prob(uint good, uint bad, uint goodmsgs, uint badmsgs)
 
     return fw;
 }
+
+double calc_prob(uint good, uint bad, uint goodmsgs, uint badmsgs)
+{
+    memo_t *m;
+
+    if (good >= MEMO_CNT || bad >= MEMO_CNT)
+	return calc_prob_uncached(good, bad, goodmsgs, badmsgs);
+
+    if (memo_gen == 0 ||
+	goodmsgs != memo_goodmsgs || badmsgs != memo_badmsgs ||
+	robs != memo_robs || robx != memo_robx) {
+	if (++memo_gen == 0) {		/* wrapped, invalidate all */
+	    memset(memo, 0, sizeof(memo));
+	    memo_gen = 1;
+	}
+	memo_goodmsgs = goodmsgs;
+	memo_badmsgs  = badmsgs;
+	memo_robs = robs;
+	memo_robx = robx;
+    }
+
+    m = &memo[good][bad];
+    if (m->gen != memo_gen) {
+	m->prob = calc_prob_uncached(good, bad, goodmsgs, badmsgs);
+	m->gen  = memo_gen;
+	PERFSTATS_COUNT(PC_PROB_MISSES, 1);
+    }
+    else
+	PERFSTATS_COUNT(PC_PROB_HITS, 1);
+
+    return m->prob;
+}
+
+/* The generation is a FNV-1a hash of the parameters calc_prob()
+** depends on.  Zero is reserved for "not precomputed".
+*/
+
+static u_int32_t fnv_add(u_int32_t h, const void *data, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)data;
+
+    while (len-- > 0) {
+	h ^= *p++;
+	h *= 16777619u;
+    }
+
+    return h;
+}
+
+u_int32_t prob_generation(uint goodmsgs, uint badmsgs)
+{
+    u_int32_t h = 2166136261u;
+
+    h = fnv_add(h, &robs, sizeof(robs));
+    h = fnv_add(h, &robx, sizeof(robx));
+    h = fnv_add(h, &goodmsgs, sizeof(goodmsgs));
+    h = fnv_add(h, &badmsgs, sizeof(badmsgs));
+
+    return (h != 0) ? h : 1;
+}
+
+#define	PROB_SCALE	4294967295.0
+
+u_int32_t prob_quantize(double prob)
+{
+    return (u_int32_t)(prob * PROB_SCALE + 0.5);
+}
+
+double prob_unquantize(u_int32_t q)
+{
+    return q / PROB_SCALE;
+}
@@ -14,5 +14,16 @@ AUTHOR:
 /** calculate the probability that a token is bad */
 extern double calc_prob(uint good, uint bad, uint goodmsgs, uint badmsgs);
 
+/** calc_prob() without its cache, safe to call from several threads */
+extern double calc_prob_uncached(uint good, uint bad, uint goodmsgs, uint badmsgs);
+
+/** identify the robs, robx and message counts a stored probability
+ * was computed with, \return non-zero generation tag */
+extern u_int32_t prob_generation(uint goodmsgs, uint badmsgs);
+
+/** convert a probability to and from its stored 32 bit form */
+extern u_int32_t prob_quantize(double prob);
+extern double prob_unquantize(u_int32_t q);
+
 #endif	/* PROB_H */
 
@@ -1,6 +1,7 @@
 #include "config.h"
 #include "system.h"
 
+#include "perfstats.h"
 #include "rand_sleep.h"
 
 #include <stdlib.h>
@@ -23,3 +24,11 @@ void rand_sleep(double min, double max)
 #endif
     bf_sleep(delay);
 }
+
+void lock_sleep(double min, double max)
+{
+    phase_t prev = PERFSTATS_ENTER(PH_LOCK_WAIT);
+    PERFSTATS_COUNT(PC_LOCK_WAITS, 1);
+    rand_sleep(min, max);
+    PERFSTATS_LEAVE(prev);
+}
@@ -3,4 +3,8 @@
 
 extern void rand_sleep(double min, double max);
 
+/* rand_sleep() while another process holds a lock we need, counted
+ * as a lock wait by --stats-json */
+extern void lock_sleep(double min, double max);
+
 #endif
@@ -8,7 +8,9 @@
 #include "datastore.h"
 #include "collect.h"
 #include "format.h"
+#include "journal.h"
 #include "msgcounts.h"
+#include "perfstats.h"
 #include "rand_sleep.h"
 #include "register.h"
 #include "wordhash.h"
@@ -16,29 +18,21 @@
 
 #define PLURAL(count) ((count == 1) ? "" : "s")
 
-/*
- * tokenize text on stdin and register it to a specified list
- * and possibly out of another list
- */
-void register_words(run_t _run_type, wordhash_t *h, u_int32_t msgcount)
+/* wait before retrying an aborted registration, twice as long for
+ * each retry, from 4 ms up to 1 s */
+static void retry_backoff(int retries)
 {
-    const char *r="",*u="";
-    dsv_t val;
-    hashnode_t *node;
-    wordprop_t *wordprop;
-    run_t save_run_type = run_type;
-    int retrycount = 60;		/* we'll retry an aborted
-					   registration five dozen times
-					   before giving up. */
-    bool first;
+    double max = 4.0e3 * (1 << min(retries, 8));
+    lock_sleep(max / 2, max);
+}
 
+/* find the counts to increment and decrement, and log the registration */
+static void begin_registration(run_t _run_type, wordhash_t *h, u_int32_t *msgcount,
+			       sh_t *incr, sh_t *decr)
+{
+    const char *r="",*u="";
     u_int32_t wordcount = h->count;	/* use number of unique tokens */
 
-    /* registrations always go to the default wordlist */
-    wordlist_t *list = get_default_wordlist(word_lists);
-
-    sh_t incr = IX_UNDF, decr = IX_UNDF;
-
     /* If update directory explicitly supplied, setup the wordlists. */
     if (update_dir) {
 	if (set_wordlist_dir(update_dir, PR_CFG_UPDATE) != 0) {
@@ -47,26 +41,57 @@ void register_words(run_t _run_type, wordhash_t *h, u_int32_t msgcount)
 	}
     }
 
-    if (_run_type & REG_SPAM)	{ r = "s"; incr = IX_SPAM; }
-    if (_run_type & REG_GOOD)	{ r = "n"; incr = IX_GOOD; }
-    if (_run_type & UNREG_SPAM)	{ u = "S"; decr = IX_SPAM; }
-    if (_run_type & UNREG_GOOD)	{ u = "N"; decr = IX_GOOD; }
+    *incr = *decr = IX_UNDF;
+    if (_run_type & REG_SPAM)	{ r = "s"; *incr = IX_SPAM; }
+    if (_run_type & REG_GOOD)	{ r = "n"; *incr = IX_GOOD; }
+    if (_run_type & UNREG_SPAM)	{ u = "S"; *decr = IX_SPAM; }
+    if (_run_type & UNREG_GOOD)	{ u = "N"; *decr = IX_GOOD; }
 
     if (wordcount == 0)
-	msgcount = 0;
+	*msgcount = 0;
 
-    format_set_counts(wordcount, msgcount);
+    format_set_counts(wordcount, *msgcount);
     format_log_update(msg_register, msg_register_size, u, r);
 
     if (verbose)
 	(void)fprintf(dbgout, "# %u word%s, %u message%s\n", 
-		      wordcount, PLURAL(wordcount), msgcount, PLURAL(msgcount));
+		      wordcount, PLURAL(wordcount), *msgcount, PLURAL(*msgcount));
+}
+
+/*
+ * tokenize text on stdin and register it to a specified list
+ * and possibly out of another list
+ */
+void register_words(run_t _run_type, wordhash_t *h, u_int32_t msgcount)
+{
+    dsv_t val;
+    hashnode_t *node;
+    wordprop_t *wordprop;
+    run_t save_run_type = run_type;
+    int retrycount = 60;		/* we'll retry an aborted
+					   registration five dozen times
+					   before giving up. */
+    int retries = 0;
+    bool first;
+
+    /* registrations always go to the default wordlist */
+    wordlist_t *list = get_default_wordlist(word_lists);
+
+    sh_t incr, decr;
+
+    begin_registration(_run_type, h, &msgcount, &incr, &decr);
 
     /* When using auto-update with separate wordlists , 
        datastore.c needs to know which to update */
 
     run_type = (run_t)(run_type | _run_type);
 
+    /* Update the tokens in key order.  Every registering process then
+     * locks the database pages in the same order (after the message
+     * counts, which begin_wordlist() reads), so concurrent
+     * registrations wait for each other instead of deadlocking. */
+    wordhash_sort_by(h, ds_keys_coded(list->dsh) ? ds_coded_key_cmp : word_cmp);
+
     first = true;
 
 retry:
@@ -75,6 +100,8 @@ retry:
     else {
 	if (verbose)
 	    fprintf(stderr, "retrying registration after avoided deadlock...\n");
+	PERFSTATS_COUNT(PC_DS_RETRIES, 1);
+	retries += 1;
 	begin_wordlist(list);
     }
 
@@ -88,7 +115,7 @@ retry:
 	wordprop = (wordprop_t *)node->data;
 	switch (ds_read(list->dsh, node->key, &val)) {
 	    case DS_ABORT_RETRY:
-		rand_sleep(4*1000,1000*1000);
+		retry_backoff(retries);
 		goto retry;
 	    case 0:
 	    case 1:
@@ -107,7 +134,7 @@ retry:
 	}
 	switch (ds_write(list->dsh, node->key, &val)) {
 	    case DS_ABORT_RETRY:
-		rand_sleep(4*1000,1000*1000);
+		retry_backoff(retries);
 		goto retry;
 	    case 0:
 		break;
@@ -122,7 +149,7 @@ retry:
 	case 1:
 	    break;
 	case DS_ABORT_RETRY:
-	    rand_sleep(4 * 1000, 1000 * 1000);
+	    retry_backoff(retries);
 	    goto retry;
 	default:
 	    fprintf(stderr, "cannot get message count values.\n");
@@ -148,7 +175,7 @@ retry:
 	case 0:
 	    break;
 	case DS_ABORT_RETRY:
-	    rand_sleep(4 * 1000, 1000 * 1000);
+	    retry_backoff(retries);
 	    goto retry;
 	default:
 	    fprintf(stderr, "cannot set message count values\n");
@@ -159,5 +186,33 @@ retry:
 	(void)fprintf(dbgout, "bogofilter: list %s (%s) - %ul spam, %ul good\n",
 		      list->listname, list->bfp->filepath, val.spamcount, val.goodcount);
 
+    /* in the same transaction, for --export-delta */
+    switch (replog_append(list->dsh, list->bfp, incr, decr, h, msgcount)) {
+	case 0:
+	    break;
+	case DS_ABORT_RETRY:
+	    retry_backoff(retries);
+	    goto retry;
+	default:
+	    fprintf(stderr, "cannot write to data base.\n");
+	    exit(EX_ERROR);
+    }
+
+    if (verbose && retries != 0)
+	(void)fprintf(dbgout, "# %d retr%s after avoided deadlock\n",
+		      retries, (retries == 1) ? "y" : "ies");
+
     run_type = save_run_type;
 }
+
+/*
+ * as register_words, but append the registration to the journal of the
+ * default wordlist, for bogoutil --fold-journal
+ */
+void journal_words(run_t _run_type, wordhash_t *h, u_int32_t msgcount)
+{
+    sh_t incr, decr;
+
+    begin_registration(_run_type, h, &msgcount, &incr, &decr);
+    journal_append(incr, decr, h, msgcount);
+}
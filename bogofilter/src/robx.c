@@ -68,6 +68,15 @@ static ex_t robx_hook(word_t *key, dsv_t *data,
     return EX_OK;
 }
 
+static void robx_merge(void *userdata, void *part)
+{
+    rhd_t *rh = (rhd_t *)userdata;
+    const rhd_t *rp = (const rhd_t *)part;
+
+    rh->sum   += rp->sum;
+    rh->count += rp->count;
+}
+
 /** returns negative for failure.
  * used by bogoutil and bogotune */
 double compute_robinson_x(void)
@@ -103,7 +112,7 @@ double compute_robinson_x(void)
     rh.count = 0;
 
     do {
-	ret = ds_foreach(dsh, robx_hook, &rh);
+	ret = ds_foreach_parallel(dsh, scan_threads, robx_hook, &rh, sizeof(rh), robx_merge);
 	if (ret == DS_ABORT_RETRY) {
 	    rand_sleep(1000, 1000000);
 	    begin_wordlist(wordlist);
@@ -15,14 +15,16 @@ NAME:
 #include "bogofilter.h"
 #include "collect.h"
 #include "datastore.h"
-#include "listsort.h"
+#include "journal.h"
 #include "msgcounts.h"
+#include "perfstats.h"
 #include "prob.h"
 #include "rand_sleep.h"
 #include "rstats.h"
 #include "score.h"
 #include "wordhash.h"
 #include "wordlists.h"
+#include "xmalloc.h"
 
 #if defined(HAVE_GSL_10) && !defined(HAVE_GSL_14)
 /* HAVE_GSL_14 implies HAVE_GSL_10
@@ -59,17 +61,37 @@ typedef struct score_s {
 
 /* Function Prototypes */
 
-static	double	get_spamicity(size_t robn, FLOAT P, FLOAT Q);
+static	double	get_spamicity(size_t robn, double p_ln, double q_ln);
 static	bool	need_scoring_boundary(size_t count);
 static	double	find_scoring_boundary(wordhash_t *wh);
 static	size_t	compute_count_and_scores(wordhash_t *wh);
-static	size_t	compute_count_and_spamicity(wordhash_t *wh, FLOAT *P, FLOAT *Q, bool need_stats);
-static	int	compare_hashnode_t(const void *const pv1, const void *const pv2);
+static	size_t	compute_count_and_spamicity(wordhash_t *wh, double *p_ln, double *q_ln, bool need_stats);
+static	FLOAT	float_from_log(double ln);
 
 /* Static Variables */
 
 static score_t	score;
 
+/* Log domain kernel:
+**
+** With both ESF values at 1.0 the chi-square degrees of freedom are
+** even, 2*robn, and the tail probability is a finite series.  The
+** token probabilities are collected into a dense array, their logs
+** summed in one pass, and the series evaluated directly instead of
+** through GSL.  BOGOTEST 'G' forces the GSL path, for comparison.
+*/
+
+#define	RECIP_SIZE	1024		/* precomputed 1/k for the series */
+
+static	double	*kernel_probs;		/* probabilities of used tokens */
+static	size_t	kernel_size;
+static	double	recip[RECIP_SIZE];
+
+/* dense array of token deviations, for find_scoring_boundary() */
+
+static	double	*bound_devs;
+static	size_t	bound_size;
+
 /* Function Definitions */
 
 double msg_spamicity(void)
@@ -77,18 +99,23 @@ double msg_spamicity(void)
     return score.spamicity;
 }
 
-rc_t msg_status(void)
+static rc_t spamicity_status(double spamicity)
 {
-    if (score.spamicity >= spam_cutoff)
+    if (spamicity >= spam_cutoff)
 	return RC_SPAM;
 
     if ((ham_cutoff < EPS) ||
-	(score.spamicity <= ham_cutoff))
+	(spamicity <= ham_cutoff))
 	return RC_HAM;
 
     return RC_UNSURE;
 }
 
+rc_t msg_status(void)
+{
+    return spamicity_status(score.spamicity);
+}
+
 void msg_print_stats(FILE *fp)
 {
     bool unsure = unsure_stats && (msg_status() == RC_UNSURE) && verbose;
@@ -102,34 +129,79 @@ void msg_print_stats(FILE *fp)
 	rstats_print(unsure);
 }
 
-/** search token in all lists according to precedence, summing up the
- * counts (all lists at same precedence are used); if found, set cnts
- * accordingly. */
-static int lookup(const word_t *token, wordcnts_t *cnts)
+/* a token being looked up by lookup_words() */
+typedef struct {
+    const word_t *token;
+    wordprop_t	 *props;
+    int		 found;		/* lists contributing */
+    bool	 prob_ok;	/* props->prob is from the wordlist */
+    bool	 done;		/* found on an ignore list */
+} pending_t;
+
+static int cmp_pending(const void *a, const void *b)
 {
-    int override=0;
-    wordlist_t* list;
-
-    if (fBogotune) {
-	wordprop_t *wp = (wordprop_t *)wordhash_search_memory(token);
-	if (wp) {
-	    cnts->good = wp->cnts.good;
-	    cnts->bad  = wp->cnts.bad;
-	}
+    return word_cmp(((const pending_t *)a)->token, ((const pending_t *)b)->token);
+}
+
+/* the same for a wordlist with coded keys */
+static int cmp_pending_coded(const void *a, const void *b)
+{
+    return ds_coded_key_cmp(((const pending_t *)a)->token, ((const pending_t *)b)->token);
+}
+
+static ex_t ignore_hook(word_t *key, dsv_t *data, void *userdata)
+{
+    (void)data;
+    (void)wordhash_insert((wordhash_t *)userdata, key, 0, NULL);
+    return EX_OK;
+}
+
+/* Read the tokens of an ignore list into memory, so that lookups
+ * don't search the list's file.  Ignore lists are short. */
+static void load_ignore_list(wordlist_t *list)
+{
+    wordhash_t *wh = wordhash_new();
+
+    if (ds_foreach(list->dsh, ignore_hook, wh) == EX_OK)
+	list->ignored = wh;
+    else
+	wordhash_free(wh);	/* look tokens up one by one */
+}
+
+/* read one token of a list, \return as ds_read() */
+static int lookup_list(wordlist_t *list, const word_t *token, dsv_t *val)
+{
+    if (list->ignored != NULL) {
+	if (wordhash_search(list->ignored, token, 0) == NULL)
+	    return 1;
+	memset(val, 0, sizeof(*val));
 	return 0;
     }
 
-    cnts->msgs_bad = cnts->msgs_good = 0;
+    return ds_read(list->dsh, token, val);
+}
 
-    for (list=word_lists; list != NULL; list=list->next)
-    {
+/* Look up the tokens in one list, after the lists of higher
+ * precedence, summing up the counts (all lists at same precedence are
+ * used).  A token found on an ignore list gets zero counts and is not
+ * looked up in further lists.  \return 0 or DS_ABORT_RETRY */
+static int lookup_in_list(wordlist_t *list, pending_t *pend, size_t count)
+{
+    size_t i;
+
+    if (list->type == WL_IGNORE && list->ignored == NULL)
+	load_ignore_list(list);
+
+    for (i = 0; i < count; i += 1) {
+	pending_t *p = &pend[i];
+	wordcnts_t *cnts = &p->props->cnts;
 	dsv_t val;
 	int ret;
 
-	if (override > list->override)	/* if already found */
-	    break;
+	if (p->done)
+	    continue;
 
-	ret = ds_read(list->dsh, token, &val);
+	ret = lookup_list(list, p->token, &val);
 
 	/* check if we have the token */
 	switch (ret) {
@@ -143,68 +215,129 @@ static int lookup(const word_t *token, wordcnts_t *cnts)
 		break;
 	    case DS_ABORT_RETRY:
 		/* sleep, reinitialize and start over */
-		rand_sleep(1000,1000000);
+		lock_sleep(1000,1000000);
 		begin_wordlist(list);
 		/* FALLTHROUGH */
 	    default:
 		return ret;
 	}
 
+	/* add registrations not yet folded from the journal */
+	(void) journal_lookup(list, p->token, &val);
+
 	if (ret == 0 && list->type == WL_IGNORE) {	/* if found on ignore list */
 	    cnts->good = cnts->bad = 0;
-	    break;
+	    p->prob_ok = false;
+	    p->done = true;
+	    continue;
 	}
 
-	override=list->override;
-
 	if (DEBUG_ALGORITHM(2)) {
 	    fprintf(dbgout, "%6d %5u %5u %5u %5u list=%s,%c,%d ",
 		    ret, (uint)val.count[IX_GOOD], (uint)val.count[IX_SPAM],
 		    (uint)list->msgcount[IX_GOOD], (uint)list->msgcount[IX_SPAM],
 		    list->listname, list->type, list->override);
-	    word_puts(token, 0, dbgout);
+	    word_puts(p->token, 0, dbgout);
 	    fputc('\n', dbgout);
 	}
 
+	/* a precomputed probability is usable if this list is the
+	 * only one contributing and its generation is current */
+	p->found += 1;
+	p->prob_ok = (ret == 0 && val.prob_gen != 0 &&
+		      val.prob_gen == prob_generation(list->msgcount[IX_GOOD],
+						      list->msgcount[IX_SPAM]));
+	if (p->prob_ok)
+	    p->props->prob = prob_unquantize(val.prob);
+
 	cnts->good += val.count[IX_GOOD];
 	cnts->bad += val.count[IX_SPAM];
 	cnts->msgs_good += list->msgcount[IX_GOOD];
 	cnts->msgs_bad += list->msgcount[IX_SPAM];
     }
 
-    if (DEBUG_ALGORITHM(1)) {
-	fprintf(dbgout, "%5u %5u ", (uint)cnts->bad, (uint)cnts->good);
-	word_puts(token, 0, dbgout);
-	fputc('\n', dbgout);
-    }
-
     return 0;
 }
 
-
-/* do wordlist lookups for the words in the wordhash
+/* do wordlist lookups for the words in the wordhash that have not
+ * been looked up yet (msg_score_settled() may have done some).
+ * The lists are searched one after the other, in precedence order,
+ * each for all the tokens, in key order.
  */
 void lookup_words(wordhash_t *wh)
 {
-    int ret;
     hashnode_t *node;
+    pending_t *pend;
+    wordlist_t *list;
+    size_t count, i;
+    bool all = false;
+    int ret, sorted;
 
     if (msg_count_file)	/* if mc file, already done */
 	return;
 
+    pend = (pending_t *)xcalloc(wh->count + 1, sizeof(pending_t));
+
 retry:
+    count = 0;
     for (node = (hashnode_t *)wordhash_first(wh); node != NULL; node = (hashnode_t *)wordhash_next(wh))
     {
-	word_t *token     = node->key;
 	wordprop_t *props = (wordprop_t *) node->data;
-	wordcnts_t *cnts  = &props->cnts;
-	ret = lookup(token, cnts);
-	if (ret == DS_ABORT_RETRY)
+	if (props->looked_up && !all)
+	    continue;
+	props->precomputed = false;
+	if (fBogotune) {
+	    wordprop_t *wp = (wordprop_t *)wordhash_search_memory(node->key);
+	    if (wp) {
+		props->cnts.good = wp->cnts.good;
+		props->cnts.bad  = wp->cnts.bad;
+	    }
+	    props->looked_up = true;
+	    continue;
+	}
+	memset(&pend[count], 0, sizeof(pending_t));
+	pend[count].token = node->key;
+	pend[count].props = props;
+	props->cnts.good = props->cnts.bad = 0;
+	props->cnts.msgs_good = props->cnts.msgs_bad = 0;
+	count += 1;
+    }
+
+    sorted = -1;
+    for (list = word_lists; list != NULL && count != 0; list = list->next) {
+	/* in the list's key order; lists in memory don't care */
+	int coded = (list->ignored == NULL && ds_keys_coded(list->dsh));
+	if (coded != sorted && (list->ignored == NULL || sorted < 0)) {
+	    qsort(pend, count, sizeof(pending_t), coded ? cmp_pending_coded : cmp_pending);
+	    sorted = coded;
+	}
+	ret = lookup_in_list(list, pend, count);
+	if (ret == DS_ABORT_RETRY) {
 	    /* start all over, the message counts may have changed
-	     * lookup handles reinitializing the wordlist */
+	     * lookup_in_list handles reinitializing the wordlist */
+	    PERFSTATS_COUNT(PC_DS_RETRIES, 1);
+	    all = true;
 	    goto retry;
+	}
+	if (ret != 0)
+	    break;
+    }
+
+    for (i = 0; i < count; i += 1) {
+	pending_t *p = &pend[i];
+
+	p->props->precomputed = p->prob_ok && p->found == 1;
+	p->props->looked_up = true;
+
+	if (DEBUG_ALGORITHM(1)) {
+	    fprintf(dbgout, "%5u %5u ", (uint)p->props->cnts.bad, (uint)p->props->cnts.good);
+	    word_puts(p->token, 0, dbgout);
+	    fputc('\n', dbgout);
+	}
     }
 
+    xfree(pend);
+
     return;
 }
 
@@ -212,8 +345,8 @@ retry:
  * \return -1.0 for error, S otherwise */
 double msg_compute_spamicity(wordhash_t *wh) /*@globals errno@*/
 {
-    FLOAT P = {1.0, 0};		/* Robinson's P */
-    FLOAT Q = {1.0, 0};		/* Robinson's Q */
+    double p_ln = 0.0;		/* Robinson's P, as a log */
+    double q_ln = 0.0;		/* Robinson's Q, as a log */
 
     double spamicity;
     size_t robn = 0;
@@ -235,21 +368,81 @@ double msg_compute_spamicity(wordhash_t *wh) /*@globals errno@*/
 	score.min_dev = find_scoring_boundary(wh);
 
     /* compute message spamicity from the wordhash's scores */
-    robn = compute_count_and_spamicity(wh, &P, &Q, need_stats);
+    robn = compute_count_and_spamicity(wh, &p_ln, &q_ln, need_stats);
 
     /* Robinson's P, Q and S
     ** S = (P - Q) / (P + Q)			    [combined indicator]
     */
-    spamicity = get_spamicity(robn, P, Q);
+    spamicity = get_spamicity(robn, p_ln, q_ln);
 
     if (need_stats && robn != 0)
-	rstats_fini(robn, P, Q, spamicity);
+	rstats_fini(robn, float_from_log(p_ln), float_from_log(q_ln), spamicity);
 
     if (DEBUG_ALGORITHM(2)) fprintf(dbgout, "### msg_compute_spamicity() ends\n");
 
     return spamicity;
 }
 
+/* msg_score_settled()
+**	score the tokens collected so far and check whether up to
+**	'budget' more tokens could still change the verdict.
+**
+**	A message counts each token once, so token counts do not exceed
+**	the message counts n, and token probabilities lie between
+**	s*x/(s+n) and (s*x+n)/(s+n).  For a given number of added tokens
+**	the spamicity grows with each token's probability, so its range
+**	is bounded by adding that many tokens all at either end.
+*/
+bool msg_score_settled(wordhash_t *wh, size_t budget)
+{
+    double p_ln, q_ln;
+    double n = 0.0;
+    double lo, hi;
+    size_t robn, k;
+    rc_t status;
+    bool settled = true;
+    score_t saved = score;
+    wordlist_t *list;
+
+    if (fBogotune || msg_count_file ||
+	token_count_fix != 0 || token_count_min != 0 || token_count_max != 0)
+	return false;		/* more tokens may displace used ones */
+
+    lookup_words(wh);
+    compute_count_and_scores(wh);
+    score.min_dev = min_dev;
+    robn = compute_count_and_spamicity(wh, &p_ln, &q_ln, false);
+    status = spamicity_status(get_spamicity(robn, p_ln, q_ln));
+
+    for (list = word_lists; list != NULL; list = list->next)
+	n += (double) list->msgcount[IX_GOOD] + list->msgcount[IX_SPAM];
+
+    /* the extreme probabilities of tokens that are used */
+    lo = robs * robx / (robs + n);
+    hi = (robs * robx + n) / (robs + n);
+    if (lo >= EVEN_ODDS - min_dev)
+	lo = EVEN_ODDS + min_dev;
+    if (hi <= EVEN_ODDS + min_dev)
+	hi = EVEN_ODDS - min_dev;
+    if (lo > hi)
+	budget = 0;		/* no token can be used */
+
+    /* the largest count is the most likely to cross, try it first */
+    for (k = budget; settled && k > 0; k -= 1) {
+	double s_lo = get_spamicity(robn + k, p_ln + k * log(1.0 - lo), q_ln + k * log(lo));
+	double s_hi = get_spamicity(robn + k, p_ln + k * log(1.0 - hi), q_ln + k * log(hi));
+	settled = (spamicity_status(s_lo) == status &&
+		   spamicity_status(s_hi) == status);
+    }
+
+    if (DEBUG_ALGORITHM(1) && settled)
+	fprintf(dbgout, "### score settled at %f with %lu tokens to go\n",
+		score.spamicity, (unsigned long) budget);
+
+    score = saved;
+    return settled;
+}
+
 /*
 ** compute_count_and_scores()
 **	compute the token probabilities from the linked list of tokens
@@ -269,8 +462,9 @@ static size_t compute_count_and_scores(wordhash_t *wh)
 
 	props = (wordprop_t *) node->data;
 	cnts  = &props->cnts;
-	props->prob = calc_prob(cnts->good, cnts->bad,
-				cnts->msgs_good, cnts->msgs_bad);
+	if (!props->precomputed)
+	    props->prob = calc_prob(cnts->good, cnts->bad,
+				    cnts->msgs_good, cnts->msgs_bad);
 	props->used = fabs(props->prob - EVEN_ODDS) > min_dev;
 	if (props->used)
 	    count += 1;
@@ -279,17 +473,66 @@ static size_t compute_count_and_scores(wordhash_t *wh)
     return count;
 }
 
+static bool use_log_kernel(void)
+{
+    return !BOGOTEST('G') && sp_esf == 1.0 && ns_esf == 1.0;
+}
+
+static FLOAT float_from_log(double ln)
+{
+    FLOAT f;
+    double ln2 = log(2.0);				/* ln(2) */
+    double e = floor(ln / ln2);
+
+    f.exp  = (int) e;
+    f.mant = exp(ln - e * ln2);
+
+    return f;
+}
+
+static void kernel_add(size_t count, double prob)
+{
+    if (count >= kernel_size) {
+	kernel_size = (kernel_size == 0) ? 256 : kernel_size * 2;
+	kernel_probs = (double *)xrealloc(kernel_probs, kernel_size * sizeof(double));
+    }
+    kernel_probs[count] = prob;
+}
+
+/* sum the logs of p and 1-p in one pass over the dense array */
+
+static void kernel_log_sums(size_t count, double *p_ln, double *q_ln)
+{
+    size_t i;
+    double p = 0.0;
+    double q = 0.0;
+    const double *prob = kernel_probs;
+
+    for (i = 0; i < count; i += 1) {
+	p += log(1.0 - prob[i]);
+	q += log(prob[i]);
+    }
+
+    *p_ln = p;
+    *q_ln = q;
+}
+
 /*
 ** compute_count_and_score()
 **	compute the spamicity from the linked list of tokens using
 **	min_dev to select tokens
 */
 static size_t compute_count_and_spamicity(wordhash_t *wh, 
-					  FLOAT *P, FLOAT *Q,
+					  double *p_ln, double *q_ln,
 					  bool need_stats)
 {
     size_t count = 0;
 
+    FLOAT P = {1.0, 0};		/* Robinson's P */
+    FLOAT Q = {1.0, 0};		/* Robinson's Q */
+
+    bool log_kernel = use_log_kernel();
+
     hashnode_t *node;
 
     for (node = (hashnode_t *)wordhash_first(wh); node != NULL; node = (hashnode_t *)wordhash_next(wh))
@@ -322,19 +565,23 @@ static size_t compute_count_and_spamicity(wordhash_t *wh,
 	 * P = 1 - ((1-p1)*(1-p2)*...*(1-pn))^(1/n)	[spamminess]
 	 * Q = 1 - (p1*p2*...*pn)^(1/n)			[non-spamminess]
 	 */
-	if (useflag ) {
+	if (useflag && log_kernel) {
+	    kernel_add(count, prob);
+	    count += 1;
+	}
+	else if (useflag) {
 	    int e;
 
-	    P->mant *= 1-prob;
-	    if (P->mant < 1.0e-200) {
-		P->mant = frexp(P->mant, &e);
-		P->exp += e;
+	    P.mant *= 1-prob;
+	    if (P.mant < 1.0e-200) {
+		P.mant = frexp(P.mant, &e);
+		P.exp += e;
 	    }
 
-	    Q->mant *= prob;
-	    if (Q->mant < 1.0e-200) {
-		Q->mant = frexp(Q->mant, &e);
-		Q->exp += e;
+	    Q.mant *= prob;
+	    if (Q.mant < 1.0e-200) {
+		Q.mant = frexp(Q.mant, &e);
+		Q.exp += e;
 	    }
 	    count += 1;
 	}
@@ -347,6 +594,16 @@ static size_t compute_count_and_spamicity(wordhash_t *wh,
 	}
     }
 
+    if (log_kernel)
+	kernel_log_sums(count, p_ln, q_ln);
+    else {
+	double ln2 = log(2.0);				/* ln(2) */
+
+	/* convert to natural logs */
+	*p_ln = log(P.mant) + P.exp * ln2;
+	*q_ln = log(Q.mant) + Q.exp * ln2;
+    }
+
     return count;
 }
 
@@ -365,90 +622,102 @@ static bool need_scoring_boundary(size_t count)
 	return true;
 }
 
+/* select_boundary( )
+**	partially order the array (nth_element style) so that devs[k]
+**	holds the (k+1)-th largest deviation, and return it.
+*/
+static double select_boundary(double *devs, size_t n, size_t k)
+{
+    size_t lo = 0;
+    size_t hi = n - 1;
+
+    while (lo < hi) {
+	size_t i = lo;
+	size_t j = hi;
+	double pivot = devs[lo + (hi - lo) / 2];
+
+	/* partition in descending order */
+	while (i <= j) {
+	    while (devs[i] > pivot)
+		i += 1;
+	    while (devs[j] < pivot)
+		j -= 1;
+	    if (i <= j) {
+		double t = devs[i];
+		devs[i] = devs[j];
+		devs[j] = t;
+		i += 1;
+		if (j == 0)
+		    break;
+		j -= 1;
+	    }
+	}
+
+	if (k <= j)
+	    hi = j;
+	else if (k >= i)
+	    lo = i;
+	else
+	    break;
+    }
+
+    return devs[k];
+}
+
 /* find_scoring_boundary( )
 **	determine the token score that gives the desired token count
 **	for scoring the message.
+**
+**	The deviations are computed once into a dense array and the
+**	boundary found by selection, in linear time, rather than by
+**	sorting the token list.
 */
 static double find_scoring_boundary(wordhash_t *wh)
 {
-    size_t count = 0;
+    size_t i, n = 0;
+    size_t count = max(token_count_fix, max(token_count_min, token_count_max));
 
     double min_prob = (token_count_max == 0.0) ? min_dev : 1.0;
 
     hashnode_t *node;
 
-    /* sort by ascending score difference (from 0.5) */
-    wh->iter_head = (hashnode_t *)listsort((element *)wh->iter_head, (fcn_compare *)&compare_hashnode_t);
-
-    count = max(token_count_fix, max(token_count_min, token_count_max));
-
     for (node = (hashnode_t *)wordhash_first(wh); node != NULL; node = (hashnode_t *)wordhash_next(wh)) {
-	wordcnts_t *cnts;
-	wordprop_t *props = NULL;
 	double prob;
-	double dev;
 
-	if (!fBogotune) {
-	    props = (wordprop_t *) node->data;
-	    cnts  = &props->cnts;
-	} else {
-	    cnts = (wordcnts_t *) node;
-	}
-	prob = calc_prob(cnts->good, cnts->bad,
-			 cnts->msgs_good, cnts->msgs_bad);
-	dev = fabs(prob - EVEN_ODDS);
-
-	if (count > 0) {
-	    count -= 1;
-	    if (!fBogotune)
-		props->used = true;
-	    min_prob = dev;
+	if (!fBogotune)
+	    prob = ((wordprop_t *) node->data)->prob;
+	else {
+	    wordcnts_t *cnts = (wordcnts_t *) node;
+	    prob = calc_prob(cnts->good, cnts->bad,
+			     cnts->msgs_good, cnts->msgs_bad);
 	}
-	else if (dev >= min_prob) {
-	    if (!fBogotune)
-		props->used = true;
+
+	if (n >= bound_size) {
+	    bound_size = (bound_size == 0) ? 256 : bound_size * 2;
+	    bound_devs = (double *)xrealloc(bound_devs, bound_size * sizeof(double));
 	}
+	bound_devs[n++] = fabs(prob - EVEN_ODDS);
+    }
+
+    if (n != 0 && count != 0) {
+	if (count < n)
+	    min_prob = select_boundary(bound_devs, n, count - 1);
 	else {
-	    if (!fBogotune)
-		props->used = false;
+	    /* all tokens used, boundary is the smallest deviation */
+	    min_prob = bound_devs[0];
+	    for (i = 1; i < n; i += 1)
+		min_prob = min(min_prob, bound_devs[i]);
 	}
     }
 
-    return min_prob;
-}
-
-/* compare_hashnode_t - sort by ascending score difference (from 0.5) */
-
-static int compare_hashnode_t(const void *const pv1, const void *const pv2)
-{
-    double d1;
-    double d2;
-
     if (!fBogotune) {
-	const hashnode_t *hn1 = (const hashnode_t *)pv1;
-	const hashnode_t *hn2 = (const hashnode_t *)pv2;
-	d1 = fabs(((wordprop_t *) hn1->data)->prob - EVEN_ODDS);
-	d2 = fabs(((wordprop_t *) hn2->data)->prob - EVEN_ODDS);
-    } else {
-	const wordcnts_t *cnts;
-	double prob;
-	cnts = (const wordcnts_t *) pv1;
-	prob = calc_prob(cnts->good, cnts->bad,
-			 cnts->msgs_good, cnts->msgs_bad);
-	d1 = fabs(prob - EVEN_ODDS);
-
-	cnts = (const wordcnts_t *) pv2;
-	prob = calc_prob(cnts->good, cnts->bad,
-			 cnts->msgs_good, cnts->msgs_bad);
-	d2 = fabs(prob - EVEN_ODDS);
+	for (node = (hashnode_t *)wordhash_first(wh); node != NULL; node = (hashnode_t *)wordhash_next(wh)) {
+	    wordprop_t *props = (wordprop_t *) node->data;
+	    props->used = fabs(props->prob - EVEN_ODDS) >= min_prob;
+	}
     }
 
-    if (d1 < d2)
-	return +1;
-    if (d1 > d2)
-	return -1;
-
-    return 0;
+    return min_prob;
 }
 
 void score_initialize(void)
@@ -506,6 +775,12 @@ void score_initialize(void)
 void score_cleanup(void)
 {
 /*    rstats_cleanup(); */
+    xfree(kernel_probs);
+    kernel_probs = NULL;
+    kernel_size = 0;
+    xfree(bound_devs);
+    bound_devs = NULL;
+    bound_size = 0;
 }
 
 #ifdef GSL_INTEGRATE_PDF
@@ -547,7 +822,44 @@ inline static double prbf(double x, double df)
 }
 #endif
 
-static double get_spamicity(size_t robn, FLOAT P, FLOAT Q)
+/* prbf_even()
+**	chi-square upper tail for x with 2*n degrees of freedom:
+**	Q = exp(-x/2) * sum(k=0..n-1) (x/2)^k / k!
+**	The sum is rescaled as it grows and stops once the
+**	terms no longer change it.
+*/
+static double prbf_even(double x, size_t n)
+{
+    size_t k;
+    double m = x / 2.0;
+    double term = 1.0;
+    double sum  = 1.0;
+    double scale = 0.0;		/* log of the rescaling */
+    double r;
+
+    if (recip[1] == 0.0) {
+	for (k = 1; k < RECIP_SIZE; k += 1)
+	    recip[k] = 1.0 / k;
+    }
+
+    for (k = 1; k < n; k += 1) {
+	term *= m * ((k < RECIP_SIZE) ? recip[k] : 1.0 / k);
+	sum += term;
+	if (sum > 1.0e250) {
+	    sum  *= 1.0e-250;
+	    term *= 1.0e-250;
+	    scale += 250.0 * log(10.0);
+	}
+	if (k > m && term < sum * DBL_EPSILON)
+	    break;
+    }
+
+    r = exp(log(sum) + scale - m);
+    r = min(1.0, r);
+    return (r < DBL_EPSILON) ? 0.0 : r;
+}
+
+static double get_spamicity(size_t robn, double p_ln, double q_ln)
 {
     if (robn == 0)
     {
@@ -557,16 +869,19 @@ static double get_spamicity(size_t robn, FLOAT P, FLOAT Q)
     {
 	double sp_df = 2.0 * robn * sp_esf;
 	double ns_df = 2.0 * robn * ns_esf;
-	double ln2 = log(2.0);					/* ln(2) */
 
 	score.robn = robn;
 
-	/* convert to natural logs */
-	score.p_ln = (log(P.mant) + P.exp * ln2) * sp_esf;	/* invlogsum */
-	score.q_ln = (log(Q.mant) + Q.exp * ln2) * ns_esf;	/* logsum */
+	score.p_ln = p_ln * sp_esf;				/* invlogsum */
+	score.q_ln = q_ln * ns_esf;				/* logsum */
 
-	score.p_pr = prbf(-2.0 * score.p_ln, sp_df);		/* compute P */
-	score.q_pr = prbf(-2.0 * score.q_ln, ns_df);		/* compute Q */
+	if (use_log_kernel()) {
+	    score.p_pr = prbf_even(-2.0 * score.p_ln, robn);	/* compute P */
+	    score.q_pr = prbf_even(-2.0 * score.q_ln, robn);	/* compute Q */
+	} else {
+	    score.p_pr = prbf(-2.0 * score.p_ln, sp_df);	/* compute P */
+	    score.q_pr = prbf(-2.0 * score.q_ln, ns_df);	/* compute Q */
+	}
   
 	if (!fBogotune && sp_esf >= 1.0 && ns_esf >= 1.0) {
 	    score.spamicity = (1.0 + score.q_pr - score.p_pr) / 2.0;
@@ -13,6 +13,7 @@ extern	void	score_initialize(void);
 extern	void	score_cleanup(void);
 
 extern	double	msg_compute_spamicity(wordhash_t *wordhash) /*@globals errno@*/;
+extern	bool	msg_score_settled(wordhash_t *wordhash, size_t budget);
 extern	double	msg_spamicity(void);
 extern	rc_t	msg_status(void);
 extern	void	msg_print_stats(FILE *fp);
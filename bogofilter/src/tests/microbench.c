@@ -0,0 +1,291 @@
+/* microbench.c -- time bogofilter's hot paths, for "make bench"
+ *
+ * usage: microbench count [wordlist directory]
+ *
+ * Runs each case over count synthetic items and prints one line per
+ * case:
+ *	bench <name> ops=<n> secs=<n> ops_per_sec=<n>
+ * The input is generated from a fixed seed, so runs are comparable.
+ * The datastore cases run only if a directory is given, in which a
+ * new wordlist is created.
+ */
+
+#include "common.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "base64.h"
+#include "collect.h"
+#include "datastore.h"
+#include "paths.h"
+#include "perfstats.h"
+#include "prob.h"
+#include "qp.h"
+#include "score.h"
+#include "transaction.h"
+#include "wordhash.h"
+#include "xmalloc.h"
+
+const char *progname = "microbench";
+
+static uint32_t seed = 1;
+
+static uint32_t next_rand(void)
+{
+    seed = seed * 1103515245u + 12345u;
+    return seed >> 8;
+}
+
+/* a word from a vocabulary of about 20000, with a Zipf-like skew */
+static word_t *make_word(void)
+{
+    char buf[32];
+    uint32_t r = next_rand() % 20000u;
+    r = r * (r % 7 + 1) / 7;
+    snprintf(buf, sizeof(buf), "w%lx%s", (unsigned long) r, (r & 1) ? "ing" : "");
+    return word_news(buf);
+}
+
+static void report(const char *name, unsigned long ops, double beg)
+{
+    double secs = perfstats_now() - beg;
+    printf("bench %s ops=%lu secs=%.6f ops_per_sec=%.0f\n",
+	   name, ops, secs, secs > 0.0 ? ops / secs : 0.0);
+    fflush(stdout);
+}
+
+static word_t **make_words(uint count)
+{
+    uint i;
+    word_t **words = (word_t **)xcalloc(count, sizeof(word_t *));
+
+    seed = 1;
+    for (i = 0; i < count; i += 1)
+	words[i] = make_word();
+    return words;
+}
+
+static void free_words(word_t **words, uint count)
+{
+    uint i;
+    for (i = 0; i < count; i += 1)
+	word_free(words[i]);
+    xfree(words);
+}
+
+static void bench_wordhash(word_t **words, uint count)
+{
+    uint i;
+    double beg = perfstats_now();
+    wordhash_t *wh = wordhash_new();
+
+    for (i = 0; i < count; i += 1) {
+	wordprop_t *wp = (wordprop_t *)wordhash_insert(wh, words[i], sizeof(wordprop_t), &wordprop_init);
+	wp->freq += 1;
+    }
+    report("wordhash.insert", count, beg);
+
+    beg = perfstats_now();
+    for (i = 0; i < count; i += 1)
+	(void) wordhash_search(wh, words[i], 0);
+    report("wordhash.search", count, beg);
+
+    wordhash_free(wh);
+}
+
+static void bench_decode(const char *name, const char *line, uint count,
+			 uint (*decode)(word_t *w))
+{
+    uint i;
+    size_t len = strlen(line);
+    word_t *w = word_new(NULL, len);
+    double beg = perfstats_now();
+
+    /* decoding is done in place, so each round decodes a fresh copy */
+    for (i = 0; i < count; i += 1) {
+	memcpy(w->u.text, line, len);
+	w->leng = len;
+	(void) decode(w);
+    }
+    report(name, count, beg);
+
+    word_free(w);
+}
+
+static uint qp_decode_2045(word_t *w)
+{
+    return qp_decode(w, RFC2045);
+}
+
+static void bench_prob(uint count)
+{
+    uint i;
+    double sum = 0.0;
+    double beg = perfstats_now();
+
+    /* small counts hit the cache of calc_prob(), large ones do not */
+    seed = 2;
+    for (i = 0; i < count; i += 1) {
+	uint32_t r = next_rand();
+	uint lim = (i & 1) ? 64 : 100000;
+	sum += calc_prob(r % lim, (r >> 12) % lim, 1000, 1200);
+    }
+    report("calc_prob", count, beg);
+
+    if (sum < 0.0)
+	abort();
+}
+
+static void bench_spamicity(word_t **words, uint count)
+{
+    uint i, rounds = count / 1000 + 1;
+    wordhash_t *wh = wordhash_new();
+    double beg;
+
+    /* a message of up to 1000 distinct tokens */
+    seed = 3;
+    for (i = 0; i < count && i < 1000; i += 1) {
+	wordprop_t *wp = (wordprop_t *)wordhash_insert(wh, words[i], sizeof(wordprop_t), &wordprop_init);
+	uint32_t r = next_rand();
+	wp->freq = 1;
+	wp->cnts.good = r % 200;
+	wp->cnts.bad  = (r >> 10) % 200;
+	wp->cnts.msgs_good = 1000;
+	wp->cnts.msgs_bad  = 1200;
+    }
+
+    beg = perfstats_now();
+    for (i = 0; i < rounds; i += 1)
+	(void) msg_compute_spamicity(wh);
+    report("msg_compute_spamicity", rounds, beg);
+
+    wordhash_free(wh);
+}
+
+static void bench_datastore(const char *dir, word_t **words, uint count)
+{
+    uint i;
+    void *dbe, *dsh;
+    double beg;
+    bfpath *bfp;
+
+    set_bogohome(dir);
+    bfp = bfpath_create(dir);
+    bfpath_set_bogohome(bfp);
+    if (bfpath_check_mode(bfp, BFP_MAY_CREATE) && bfp->isdir)
+	bfpath_set_filename(bfp, WORDLIST);
+    if (!bfpath_check_mode(bfp, BFP_MAY_CREATE)) {
+	fprintf(stderr, "Can't open wordlist '%s'\n", bfp->filepath);
+	exit(EX_ERROR);
+    }
+
+    dbe = ds_init(bfp);
+
+    dsh = ds_open(dbe, bfp, (dbmode_t)(DS_WRITE | DS_LOAD));
+    if (dsh == NULL || ds_txn_begin(dsh) != DST_OK) {
+	fprintf(stderr, "Can't open wordlist '%s'\n", bfp->filepath);
+	exit(EX_ERROR);
+    }
+    beg = perfstats_now();
+    for (i = 0; i < count; i += 1) {
+	dsv_t val;
+	memset(&val, 0, sizeof(val));
+	val.count[IX_SPAM] = i % 13;
+	val.count[IX_GOOD] = i % 7;
+	if (ds_write(dsh, words[i], &val) != 0) {
+	    fprintf(stderr, "cannot write to data base.\n");
+	    exit(EX_ERROR);
+	}
+    }
+    if (ds_txn_commit(dsh) != DST_OK)
+	exit(EX_ERROR);
+    ds_close(dsh);
+    report("datastore.write", count, beg);
+
+    dsh = ds_open(dbe, bfp, DS_READ);
+    if (dsh == NULL || ds_txn_begin(dsh) != DST_OK) {
+	fprintf(stderr, "Can't open wordlist '%s'\n", bfp->filepath);
+	exit(EX_ERROR);
+    }
+    beg = perfstats_now();
+    for (i = 0; i < count; i += 1) {
+	dsv_t val;
+	if (ds_read(dsh, words[i], &val) < 0) {
+	    fprintf(stderr, "cannot read from data base.\n");
+	    exit(EX_ERROR);
+	}
+    }
+    (void) ds_txn_commit(dsh);
+    ds_close(dsh);
+    report("datastore.read", count, beg);
+
+    /* queued updates, as bogoutil -m does them */
+    dsh = ds_open(dbe, bfp, DS_WRITE);
+    if (dsh == NULL || ds_txn_begin(dsh) != DST_OK) {
+	fprintf(stderr, "Can't open wordlist '%s'\n", bfp->filepath);
+	exit(EX_ERROR);
+    }
+    beg = perfstats_now();
+    {
+	ta_t *ta = ta_init();
+	for (i = 0; i < count; i += 1) {
+	    dsv_t val;
+	    memset(&val, 0, sizeof(val));
+	    val.count[IX_SPAM] = i % 5;
+	    if (i % 3 == 0)
+		ta_delete(ta, dsh, words[i]);
+	    else
+		ta_write(ta, dsh, words[i], &val);
+	}
+	if (ta_commit(ta) != TA_OK || ds_txn_commit(dsh) != DST_OK) {
+	    fprintf(stderr, "cannot write to data base.\n");
+	    exit(EX_ERROR);
+	}
+    }
+    ds_close(dsh);
+    report("transaction.commit", count, beg);
+
+    ds_cleanup(dbe);
+    bfpath_free(bfp);
+}
+
+int main(int argc, char **argv)
+{
+    uint count;
+    word_t **words;
+
+    if (argc < 2 || argc > 3) {
+	fprintf(stderr, "usage: %s count [wordlist directory]\n", progname);
+	exit(EX_ERROR);
+    }
+
+    count = (uint) atoi(argv[1]);
+    dbgout = stderr;
+
+    /* the defaults score_initialize() sets, without a wordlist */
+    min_dev = MIN_DEV;
+    robs = ROBS;
+    robx = ROBX;
+    spam_cutoff = SPAM_CUTOFF;
+
+    words = make_words(count);
+
+    bench_wordhash(words, count);
+    bench_decode("base64.decode",
+		 "TG9yZW0gaXBzdW0gZG9sb3Igc2l0IGFtZXQsIGNvbnNlY3RldHVyIGFkaXBpc2NpbmcgZWxpdC4g",
+		 count, base64_decode);
+    bench_decode("qp.decode",
+		 "Lorem ip=73um dolor sit am=C3=A9t, consectetur adipiscing =65lit, sed do=\r\n",
+		 count, qp_decode_2045);
+    bench_prob(count);
+    bench_spamicity(words, count);
+
+    if (argc == 3)
+	bench_datastore(argv[2], words, count);
+
+    free_words(words, count);
+    score_cleanup();
+
+    return 0;
+}
@@ -23,6 +23,7 @@ AUTHOR:
 #include "msgcounts.h"
 #include "word.h"
 #include "token.h"
+#include "wordhash.h"
 #include "xmemrchr.h"
 
 #define	MSG_COUNT_PADDING 2 * 10	/* space for 2 10-digit numbers */
@@ -62,11 +63,30 @@ static uint32_t token_prefix_len;
 static word_t *nonblank_line = NULL;
 
 static uint tok_count         = 0;
+static bool at_eom            = false;	/* NONE is due after summary tokens */
 static uint init_token        = 1;
-static word_t *p_multi_words  = NULL;
 static byte   *p_multi_buff   = NULL;
-static byte   *p_multi_text   = NULL;
-static word_t **w_token_array = NULL;
+
+/* Multi-word tokens are views into a window that holds the last
+ * multi_token_count tokens joined by '*'.  For each of them the window
+ * keeps its offset and the running wordhash hash of the window up to
+ * it, which gives the hash of any multi-word token ending at the last
+ * token without going over its bytes again.  Single tokens are hashed
+ * once, in get_token(), and the hash follows the token to the word
+ * hash table, through the prefix (see build_prefixed_token()). */
+typedef struct {
+    uint off;		/* offset of the token in win_text */
+    uint hash;		/* running hash before the token */
+} win_slot_t;
+
+static byte   *win_text       = NULL;
+static uint    win_size       = 0;
+static uint    win_used       = 0;
+static uint    win_hash       = 0;	/* running hash of the window */
+static win_slot_t *win_slots  = NULL;
+
+static uint    tok_hash;		/* hash of the last token ... */
+static bool    tok_hash_ok    = false;	/* ... if known */
 
 /* Function Prototypes */
 
@@ -74,39 +94,23 @@ static void    token_clear(void);
 static token_t parse_new_token(word_t *token);
 static void    add_token_to_array(word_t *token);
 static void    build_token_from_array(word_t *token);
-static uint    token_copy_leng(const char *str, uint leng, byte *dest);
 
 /* Function Definitions */
 
 static void init_token_array(void)
 {
-    uint i;
-    byte *text;
-    word_t *words;
-		    
-    p_multi_words = (word_t *)calloc( max_token_len, sizeof(word_t) );
-    p_multi_buff  = (byte *)malloc( max_multi_token_len+D );
-    p_multi_text  = (byte *)calloc( max_token_len+1+D, multi_token_count );
-    w_token_array = (word_t **)calloc( multi_token_count, sizeof(*w_token_array) );
-
-    text = p_multi_text;
-    words = p_multi_words;
-
-    for (i = 0; i < multi_token_count; i += 1) {
-	words->leng = 0;
-	words->u.text = text;
-	w_token_array[i] = words;
-	words += 1;
-	text += max_token_len+1+D;
-    }
+    /* room for two windows, so it is compacted only now and then */
+    win_size  = 2 * (max_token_len+1) * multi_token_count;
+    win_text  = (byte *)malloc( win_size+D );
+    win_slots = (win_slot_t *)calloc( multi_token_count, sizeof(win_slot_t) );
+    p_multi_buff = (byte *)malloc( max_multi_token_len+D );
 }
 
 static void free_token_array(void)
 {
-    free(p_multi_words);
-    free(p_multi_text );
+    free(win_text );
+    free(win_slots);
     free(p_multi_buff );
-    free(w_token_array);
 }
 
 static void token_set( word_t *token, byte *text, uint leng )
@@ -126,8 +130,13 @@ static void build_prefixed_token( word_t *prefix, word_t *token,
 {
     uint len = token->leng + prefix->leng;
     
-    if (len >= temp_size)
+    if (len >= temp_size) {
 	len = temp_size - prefix->leng - 1;
+	tok_hash_ok = false;
+    }
+    else if (tok_hash_ok)
+	tok_hash = wordhash_hash(0, prefix->u.text, prefix->leng) *
+		   wordhash_hash_pow(token->leng) + tok_hash;
 
     temp->leng = len;
     memmove(temp->u.text+prefix->leng, token->u.text, len-prefix->leng);
@@ -143,14 +152,35 @@ static void build_prefixed_token( word_t *prefix, word_t *token,
 token_t get_token(word_t *token)
 {
     token_t cls;
-    
-    bool fSingle = (tok_count < 2 ||
-		    tok_count <= init_token ||
-		    multi_token_count <= init_token);
+    bool fSingle;
+
+    tok_hash_ok = false;
+
+    /* summary tokens of MIME parts that were not tokenized */
+    if (mime_summary(token, false))
+	return TOKEN;
+
+    if (at_eom) {
+	at_eom = false;
+	return NONE;
+    }
+
+    fSingle = (tok_count < 2 ||
+	       tok_count <= init_token ||
+	       multi_token_count <= init_token);
 
     if (fSingle) {
 	cls = parse_new_token(token);
 
+	/* hand out the summary tokens before the end of the message */
+	if (cls == NONE && mime_summary(token, true)) {
+	    at_eom = true;
+	    return TOKEN;
+	}
+
+	tok_hash = wordhash_hash(0, token->u.text, token->leng);
+	tok_hash_ok = true;
+
 	if (multi_token_count > 1)
 	    add_token_to_array(token);
     }
@@ -471,19 +501,43 @@ token_t parse_new_token(word_t *token)
     return(cls);
 }
 
-/* save token in token array */
+/* append token to the window of recent tokens */
 
 static void add_token_to_array(word_t *token)
 {
-    word_t *w = w_token_array[WRAP(tok_count)];
+    win_slot_t *slot;
+
+    if (tok_count == 0)
+	win_used = 0;
+
+    /* move the tokens still needed to the front */
+    if (win_used + token->leng + 1 > win_size) {
+	uint i;
+	uint from = win_slots[WRAP(tok_count + 1)].off;
 
-    w->leng = token->leng;
-    memcpy(w->u.text, token->u.text, w->leng);
-    Z(w->u.text[w->leng]);	/* for easier debugging - removable */
+	memmove(win_text, win_text + from, win_used - from);
+	win_used -= from;
+	for (i = 0; i < multi_token_count; i += 1)
+	    win_slots[i].off -= min(win_slots[i].off, from);
+    }
+
+    if (tok_count != 0) {
+	win_text[win_used++] = (byte) '*';
+	win_hash = wordhash_hash(win_hash, (const byte *) "*", 1);
+    }
+
+    slot = &win_slots[WRAP(tok_count)];
+    slot->off  = win_used;
+    slot->hash = win_hash;
+
+    memcpy(win_text + win_used, token->u.text, token->leng);
+    win_hash = win_hash * wordhash_hash_pow(token->leng) + tok_hash;
+    win_used += token->leng;
+    win_text[win_used] = (byte) '\0';
 
     if (DEBUG_MULTI(1))
 	fprintf(stderr, "%s:%d  %2s  %2d %2d %p %s\n", __FILE__, __LINE__,
-		"", tok_count, w->leng, w->u.text, w->u.text);
+		"", tok_count, token->leng, win_text + slot->off, win_text + slot->off);
 
     tok_count += 1;
     init_token = 1;
@@ -491,60 +545,42 @@ static void add_token_to_array(word_t *token)
     return;
 }
 
+/* the multi-word token of the last init_token+1 tokens is the tail
+ * of the window; only a token cut to max_multi_token_len is copied */
+
 static void build_token_from_array(word_t *token)
 {
-    int tok;
-
-    const char *sep = "";
-    uint  leng;
-    byte *dest;
+    const win_slot_t *slot = &win_slots[WRAP(tok_count - 1 - init_token)];
+    uint leng = win_used - slot->off;
 
-    leng = init_token;
-    for ( tok = init_token; tok >= 0; tok -= 1 ) {
-	uint idx = tok_count - 1 - tok;
-	leng += strlen((char *) w_token_array[WRAP(idx)]->u.text);
+    if (DEBUG_MULTI(1))
+	fprintf(stderr, "%s:%d  %2d  %2d %2d %p %s\n", __FILE__, __LINE__,
+		tok_count - 1 - init_token, tok_count, leng,
+		win_text + slot->off, win_text + slot->off);
+
+    if (leng <= max_multi_token_len) {
+	token->leng = leng;
+	token->u.text = win_text + slot->off;
+	tok_hash = win_hash - slot->hash * wordhash_hash_pow(leng);
+	tok_hash_ok = true;
     }
-
-    if (leng > max_multi_token_len)
-	leng = max_multi_token_len;
-
-    token->leng = leng;
-    token->u.text = dest = p_multi_buff;
-
-    for ( tok = init_token; tok >= 0; tok -= 1 ) {
-	uint  idx = tok_count - 1 - tok;
-	uint  len = w_token_array[WRAP(idx)]->leng;
-	byte *str = w_token_array[WRAP(idx)]->u.text;
-
-	if (DEBUG_MULTI(1))
-	    fprintf(stderr, "%s:%d  %2d  %2d %2d %p %s\n", __FILE__, __LINE__,
-		    idx, tok_count, len, str, str);
-	
-	len = token_copy_leng((const char *)sep, leng, dest);
-	leng -= len;
-	dest += len;
-
-	len = token_copy_leng((const char *)str, leng, dest);
-	leng -= len;
-	dest += len;
-
-	sep = "*";
+    else {
+	token->leng = max_multi_token_len;
+	token->u.text = p_multi_buff;
+	memcpy(p_multi_buff, win_text + slot->off, max_multi_token_len);
+	Z(token->u.text[token->leng]);	/* for easier debugging - removable */
     }
 
-    Z(token->u.text[token->leng]);	/* for easier debugging - removable */
     init_token += 1;			/* progress to next multi-token */
 
     return;
 }
 
-static uint token_copy_leng(const char *str, uint leng, byte *dest)
+bool get_token_hash(uint *hash)
 {
-    uint len = strlen(str);
-    if (leng < len)
-	len  = leng;
-    if (len != 0)
-	memcpy(dest, str, len);
-    return (uint) len;
+    if (tok_hash_ok)
+	*hash = tok_hash;
+    return tok_hash_ok;
 }
 
 void token_init(void)
@@ -553,6 +589,8 @@ void token_init(void)
 
     yyinit();
 
+    at_eom = false;
+
     if ( fTokenInit) {
 	token_clear();
     }
@@ -16,6 +16,10 @@ extern word_t *queue_id;	/* Message's first Queue ID */
 
 extern token_t get_token(word_t *token);
 
+/** set \a hash to the wordhash_hash() of the token last returned by
+ *  get_token(), if known without going over its bytes again */
+extern bool get_token_hash(uint *hash);
+
 extern void got_from(void);
 extern void clr_tag(void);
 extern void set_tag(const char *text);
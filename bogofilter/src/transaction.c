@@ -10,68 +10,205 @@ Stefan Bellon <sbellon@sbellon.de>       2003
 
 #include "common.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "maint.h"
 #include "transaction.h"
+#include "wordhash.h"
 #include "xmalloc.h"
 
 /* list all kinds of operations that can be present in the scheduler queue */
 typedef enum ta_kind {
     TA_DELETE,
-    TA_WRITE
+    TA_WRITE,
+    TA_WRITE_PROB
 } ta_kind_t;
 
-/* scheduler queue item */
-typedef struct ta_iter {
+/* scheduler queue item; the token is kept in the text arena of the
+ * queue, at offset off, so that items can be sorted by moving them */
+typedef struct ta_op {
     ta_kind_t kind;
+    uint seq;			/* position in the queue */
     void *vhandle;
-    word_t *word;
-    dsv_t *dsvval;
-    struct ta_iter *next;
-    struct ta_iter *prev;
-} ta_iter_t;
+    bool coded;			/* its keys are coded, see ds_keys_coded() */
+    uint off;
+    uint leng;
+    dsv_t dsvval;		/* unused for TA_DELETE */
+} ta_op_t;
 
 /* scheduler queue anchor */
 struct ta_type {
-    ta_iter_t *head;
-    ta_iter_t *last;
+    ta_op_t *ops;		/* in queue order until ta_flush() sorts them */
+    uint count;
+    uint size;
+    byte *text;			/* tokens of all items */
+    size_t text_used;
+    size_t text_size;
+    uint *index;		/* open addressing, item number + 1 or 0 */
+    uint index_size;		/* power of 2 */
 };
 
+#define	TA_OPS_MIN	256
+#define	TA_TEXT_MIN	4096
+
 /* open a transaction and return pointer to transaction anchor */
 ta_t *ta_init(void)
 {
-    ta_t *ta = (ta_t *)xmalloc(sizeof(*ta));
-    ta->head = NULL;
-    ta->last = NULL;
+    ta_t *ta = (ta_t *)xcalloc(1, sizeof(*ta));
     return ta;
 }
 
-/* write back contents of scheduler queue to database (internal function) */
+static int ta_op_cmp_key(const ta_t *ta, const ta_op_t *op, const byte *text, uint leng)
+{
+    uint len = min(op->leng, leng);
+    int r = memcmp(ta->text + op->off, text, len);
+    if (r != 0)
+	return r;
+    return (op->leng > leng) - (op->leng < leng);
+}
+
+/* newest item for the token, or NULL */
+static ta_op_t *ta_find(const ta_t *ta, const word_t *word)
+{
+    uint mask = ta->index_size - 1;
+    uint i;
+
+    if (ta->index_size == 0)
+	return NULL;
+
+    for (i = wordhash_hash(0, word->u.text, word->leng) & mask;
+	 ta->index[i] != 0;
+	 i = (i + 1) & mask) {
+	ta_op_t *op = ta->ops + ta->index[i] - 1;
+	if (ta_op_cmp_key(ta, op, word->u.text, word->leng) == 0)
+	    return op;
+    }
+
+    return NULL;
+}
+
+/* make item n the one ta_find() returns for its token */
+static void ta_index_add(ta_t *ta, uint n)
+{
+    ta_op_t *op = ta->ops + n;
+    const byte *text = ta->text + op->off;
+    uint mask = ta->index_size - 1;
+    uint i;
+
+    for (i = wordhash_hash(0, text, op->leng) & mask;
+	 ta->index[i] != 0;
+	 i = (i + 1) & mask) {
+	if (ta_op_cmp_key(ta, ta->ops + ta->index[i] - 1, text, op->leng) == 0)
+	    break;
+    }
+    ta->index[i] = n + 1;
+}
+
+/* keep the index at most half full */
+static void ta_index_grow(ta_t *ta)
+{
+    uint n;
+
+    if (2 * (ta->count + 1) <= ta->index_size)
+	return;
+
+    xfree(ta->index);
+    ta->index_size = ta->index_size ? ta->index_size * 2 : 2 * TA_OPS_MIN;
+    ta->index = (uint *)xcalloc(ta->index_size, sizeof(uint));
+
+    for (n = 0; n < ta->count; n += 1)
+	ta_index_add(ta, n);
+}
+
+static const byte *sort_text;	/* arena of the queue being sorted */
+
+/* by database, then by token in the database's key order, then by age */
+static int ta_op_compare(const void *pv1, const void *pv2)
+{
+    const ta_op_t *op1 = (const ta_op_t *)pv1;
+    const ta_op_t *op2 = (const ta_op_t *)pv2;
+    uint len = min(op1->leng, op2->leng);
+    int r;
+
+    if (op1->vhandle != op2->vhandle)
+	return ((uintptr_t)op1->vhandle > (uintptr_t)op2->vhandle) ? 1 : -1;
+
+    if (op1->coded) {
+	word_t w1, w2;
+	w1.u.ctext = (const char *)(sort_text + op1->off);
+	w1.leng = op1->leng;
+	w2.u.ctext = (const char *)(sort_text + op2->off);
+	w2.leng = op2->leng;
+	r = ds_coded_key_cmp(&w1, &w2);
+	if (r != 0)
+	    return r;
+	return (op1->seq > op2->seq) ? 1 : -1;
+    }
+
+    r = memcmp(sort_text + op1->off, sort_text + op2->off, len);
+    if (r != 0)
+	return r;
+    if (op1->leng != op2->leng)
+	return (op1->leng > op2->leng) ? 1 : -1;
+
+    return (op1->seq > op2->seq) ? 1 : -1;
+}
+
+static void ta_free(ta_t *ta)
+{
+    xfree(ta->ops);
+    xfree(ta->text);
+    xfree(ta->index);
+    xfree(ta);
+}
+
+/* write back contents of scheduler queue to database (internal function)
+ *
+ * Only the newest item for each token matters, as each one replaces
+ * the whole record.  The items are applied sorted by key, so that the
+ * database sees its pages in order.
+ */
 static int ta_flush(ta_t *ta, bool wr)
 {
     int ret = TA_OK;
-    ta_iter_t *tmp, *iter = ta->head;
-    
-    while (iter) {
-        if (wr) {
-            switch (iter->kind) {
-            case TA_DELETE:
-                ret |= ds_delete(iter->vhandle, iter->word);
-                break;
-            case TA_WRITE:
-		set_date(iter->dsvval->date); /* wrong date otherwise! */
-                ret |= ds_write(iter->vhandle, iter->word, iter->dsvval);
-                break;
-            }
-        }
-	word_free(iter->word);
-	xfree(iter->dsvval);
-        tmp = iter;
-        iter = iter->next;
-        xfree(tmp);
+    YYYYMMDD saved = today;
+    uint n;
+
+    if (wr && ta->count != 0) {
+	sort_text = ta->text;
+	qsort(ta->ops, ta->count, sizeof(ta_op_t), ta_op_compare);
+	sort_text = NULL;
+
+	for (n = 0; n < ta->count; n += 1) {
+	    ta_op_t *op = ta->ops + n;
+	    word_t word;
+
+	    /* superseded by a newer item for the same token */
+	    if (n + 1 < ta->count && op[1].vhandle == op->vhandle &&
+		ta_op_cmp_key(ta, op + 1, ta->text + op->off, op->leng) == 0)
+		continue;
+
+	    word.u.text = ta->text + op->off;
+	    word.leng = op->leng;
+
+	    switch (op->kind) {
+	    case TA_DELETE:
+		ret |= ds_delete(op->vhandle, &word);
+		break;
+	    case TA_WRITE:
+		set_date(op->dsvval.date); /* wrong date otherwise! */
+		ret |= ds_write(op->vhandle, &word, &op->dsvval);
+		break;
+	    case TA_WRITE_PROB:
+		ret |= ds_write_prob(op->vhandle, &word, &op->dsvval);
+		break;
+	    }
+	}
+	set_date(saved);
     }
-    xfree(ta);
+
+    ta_free(ta);
 
     return ret;
 }
@@ -97,32 +234,39 @@ int ta_rollback(ta_t *ta)
 static void ta_add(ta_t *ta, ta_kind_t ta_kind, void *vhandle,
                    const word_t *word, const dsv_t *dsvval)
 {
-    void *ta_vhandle = vhandle;
-    word_t *ta_word = NULL;
-    dsv_t *ta_dsvval = NULL;
-    ta_iter_t *item = NULL;
-
-    if (word)
-        ta_word = word_dup(word);
-    
-    if (dsvval) {
-        ta_dsvval = (dsv_t *)xmalloc(sizeof(*ta_dsvval));
-	memcpy(ta_dsvval, dsvval, sizeof(*ta_dsvval));
+    ta_op_t *op;
+
+    if (ta->count == ta->size) {
+	ta->size = ta->size ? ta->size * 2 : TA_OPS_MIN;
+	ta->ops = (ta_op_t *)xrealloc(ta->ops, ta->size * sizeof(ta_op_t));
     }
-    
-    item = (ta_iter_t *)xmalloc(sizeof(*item));
-    item->kind = ta_kind;
-    item->vhandle = ta_vhandle;
-    item->word = ta_word;
-    item->dsvval = ta_dsvval;
-    item->next = NULL;
-    item->prev = ta->last;
-    
-    if (ta->head == NULL)
-        ta->head = item;
-    if (ta->last != NULL)
-        ta->last->next = item;
-    ta->last = item;
+
+    if (ta->text_used + word->leng > ta->text_size) {
+	do
+	    ta->text_size = ta->text_size ? ta->text_size * 2 : TA_TEXT_MIN;
+	while (ta->text_used + word->leng > ta->text_size);
+	ta->text = (byte *)xrealloc(ta->text, ta->text_size);
+    }
+
+    ta_index_grow(ta);
+
+    op = ta->ops + ta->count;
+    op->kind = ta_kind;
+    op->seq = ta->count;
+    op->vhandle = vhandle;
+    op->coded = ds_keys_coded(vhandle);
+    op->off = (uint)ta->text_used;
+    op->leng = word->leng;
+    if (dsvval)
+	memcpy(&op->dsvval, dsvval, sizeof(op->dsvval));
+    else
+	memset(&op->dsvval, 0, sizeof(op->dsvval));
+
+    memcpy(ta->text + ta->text_used, word->u.text, word->leng);
+    ta->text_used += word->leng;
+
+    ta_index_add(ta, ta->count);
+    ta->count += 1;
 }
 
 /* add delete operation to scheduler queue */
@@ -130,7 +274,7 @@ int ta_delete(ta_t *ta, void *vhandle, const word_t *word)
 {
     if (ta == NULL)
         return TA_ERR;
-    
+
     ta_add(ta, TA_DELETE, vhandle, word, NULL);
 
     return TA_OK;
@@ -141,41 +285,46 @@ int ta_write(ta_t *ta, void *vhandle, const word_t *word, const dsv_t *val)
 {
     if (ta == NULL)
         return TA_ERR;
-    
+
     ta_add(ta, TA_WRITE, vhandle, word, val);
 
     return TA_OK;
 }
 
+/* add write operation keeping the precomputed probability */
+int ta_write_prob(ta_t *ta, void *vhandle, const word_t *word, const dsv_t *val)
+{
+    if (ta == NULL)
+        return TA_ERR;
+
+    ta_add(ta, TA_WRITE_PROB, vhandle, word, val);
+
+    return TA_OK;
+}
+
 /* read from database, first looking whether transaction updated record */
 int ta_read(ta_t *ta, void *vhandle, const word_t *word, /*@out@*/ dsv_t *val)
 {
-    ta_iter_t *iter;
+    ta_op_t *op;
 
     if (ta == NULL)
         return TA_ERR;
-    
+
     memset(val, 0, sizeof(*val));
 
-    /* search transaction list from end to start */
-    iter = ta->last;
-    while (iter) {
-        if (word_cmp(word, iter->word) == 0) {
-            switch (iter->kind) {
-            case TA_DELETE:
-                return TA_ERR; /* token deleted, so not found */
-            case TA_WRITE:
-                if (iter->dsvval) {
-		    memcpy(val, iter->dsvval, sizeof(*iter->dsvval));
-                    return TA_OK;  /* token found */
-                }
-                else
-                    return TA_ERR; /* value should be present! ERROR! */
-            }
-        }
-        iter = iter->prev;
+    /* the newest queued operation on the token */
+    op = ta_find(ta, word);
+    if (op != NULL) {
+	switch (op->kind) {
+	case TA_DELETE:
+	    return TA_ERR; /* token deleted, so not found */
+	case TA_WRITE:
+	case TA_WRITE_PROB:
+	    memcpy(val, &op->dsvval, sizeof(op->dsvval));
+	    return TA_OK;  /* token found */
+	}
     }
-    
+
     /* token not found in our transaction list, so ask the database backend */
     return ds_read(vhandle, word, val);
 }
@@ -26,6 +26,7 @@ int ta_rollback(ta_t *ta);
 
 int ta_delete(ta_t *ta, void *vhandle, const word_t *word);
 int ta_write(ta_t *ta, void *vhandle, const word_t *word, const dsv_t *val);
+int ta_write_prob(ta_t *ta, void *vhandle, const word_t *word, const dsv_t *val);
 int ta_read(ta_t *ta, void *vhandle, const word_t *word, /*@out@*/ dsv_t *val);
 
 #endif /* TRANSACTION_H */
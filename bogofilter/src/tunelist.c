@@ -126,19 +126,44 @@ tunelist_t *tunelist_new(const char *label)
     return list;
 }
 
+/* Create the message lists for k-fold cross-validation */
+
+void tunelist_set_folds(tunelist_t *list, uint count)
+{
+    uint i;
+
+    list->fold_cnt = count;
+    list->folds = (mlhead_t **)xcalloc(count, sizeof(mlhead_t *));
+
+    for (i = 0; i < count; i += 1) {
+	char label[16];
+	snprintf(label, sizeof(label), "f%u", i);
+	list->folds[i] = msglist_new(label);
+    }
+
+    return;
+}
+
 void tunelist_print(tunelist_t *list)
 {
+    uint i;
+
     printf("%s (%u):\n", list->name, list->count);
 
     msglist_print(list->u.r.r0);	/* run sets */
     msglist_print(list->u.r.r1);
     msglist_print(list->u.r.r2);
 
+    for (i = 0; i < list->fold_cnt; i += 1)
+	msglist_print(list->folds[i]);	/* folds */
+
     return;
 }
 
 void tunelist_free(tunelist_t *list)
 {
+    uint i;
+
     if (list == NULL)
 	return;
 
@@ -147,6 +172,9 @@ void tunelist_free(tunelist_t *list)
     msglist_free(list->u.r.r0);		/* run sets */
     msglist_free(list->u.r.r1);
     msglist_free(list->u.r.r2);
+    for (i = 0; i < list->fold_cnt; i += 1)
+	msglist_free(list->folds[i]);	/* folds */
+    xfree(list->folds);
     xfree(list);
 
     return;
@@ -163,5 +191,9 @@ uint count_messages(tunelist_t *list)
 	count += list->u.sets[i]->count;
     }
 
+    for (i=0; i < list->fold_cnt; i += 1) {
+	count += list->folds[i]->count;
+    }
+
     return count;
 }
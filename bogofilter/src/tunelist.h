@@ -78,10 +78,13 @@ struct tunelist_s {
 	    mlhead_t *r2;
 	} r;
     } u;
+    uint	fold_cnt;	/* k-fold cross-validation */
+    mlhead_t  **folds;
 };
 
 uint count_messages(tunelist_t *list);
 tunelist_t *tunelist_new(const char *label);
+void tunelist_set_folds(tunelist_t *list, uint count);
 void tunelist_print(tunelist_t *list);
 void tunelist_free(tunelist_t *list);
 #endif
@@ -237,14 +237,31 @@ smalloc (wordhash_t *wh, size_t n) /*@modifies wh->strings@*/
     return (t);
 }
 
+unsigned int
+wordhash_hash (unsigned int h, const byte *text, uint leng)
+{
+    uint l;
+    for (l=0; l<leng; l++)
+	h = MULT * h + text[l];
+    return h;
+}
+
+unsigned int
+wordhash_hash_pow (uint n)
+{
+    unsigned int p = 1, m = MULT;
+    for (; n != 0; n /= 2) {
+	if (n & 1)
+	    p *= m;
+	m *= m;
+    }
+    return p;
+}
+
 static unsigned int
 hash (const word_t *t)
 {
-    unsigned int h = 0;
-    size_t l;
-    for (l=0; l<t->leng; l++)
-	h = MULT * h + t->u.text[l];
-    return h % NHASH;
+    return wordhash_hash (0, t->u.text, t->leng);
 }
 
 static void display_node(hashnode_t *n, const char *str)
@@ -276,7 +293,7 @@ void wordhash_add(wordhash_t *dest, wordhash_t *src, void (*initializer)(void *)
 	wordprop_t *d;
 	if (key == NULL)
 	    continue;
-	d = (wordprop_t *)wordhash_insert(dest, key, sizeof(wordprop_t), initializer);
+	d = (wordprop_t *)wordhash_insert_hashed(dest, key, s->hash, sizeof(wordprop_t), initializer);
 	d->freq += p->freq;
 	d->cnts.good += p->cnts.good;
 	d->cnts.bad  += p->cnts.bad;
@@ -303,7 +320,7 @@ wordhash_search (const wordhash_t *wh, const word_t *t, unsigned int idx)
     hashnode_t *hn;
 
     if (idx == 0)
-	idx = hash (t);
+	return wordhash_search_hashed (wh, t, hash (t));
 
     for (hn = wh->bin[idx]; hn != NULL; hn = hn->next) {
 	word_t *key = hn->key;
@@ -315,12 +332,30 @@ wordhash_search (const wordhash_t *wh, const word_t *t, unsigned int idx)
     return NULL;
 }
 
+/* keys with a different hash are passed over without comparing them */
+void *
+wordhash_search_hashed (const wordhash_t *wh, const word_t *t, unsigned int h)
+{
+    hashnode_t *hn;
+
+    for (hn = wh->bin[h % NHASH]; hn != NULL; hn = hn->next) {
+	word_t *key = hn->key;
+	if (hn->hash == h &&
+	    key->leng == t->leng && memcmp (t->u.text, key->u.text, t->leng) == 0) {
+	    wordprop_t *p = (wordprop_t *)hn->data;
+	    return p;
+	}
+    }
+    return NULL;
+}
+
 static void *
-wordhash_standard_insert (wordhash_t *wh, word_t *t, size_t n, void (*initializer)(void *))
+wordhash_standard_insert (wordhash_t *wh, word_t *t, unsigned int h,
+			  size_t n, void (*initializer)(void *))
 {
     hashnode_t *hn;
-    unsigned int idx = hash (t);
-    void *buf = wordhash_search(wh, t, idx);
+    unsigned int idx = h % NHASH;
+    void *buf = wordhash_search_hashed(wh, t, h);
 
     if (buf != NULL)
 	return buf;
@@ -333,6 +368,7 @@ wordhash_standard_insert (wordhash_t *wh, word_t *t, size_t n, void (*initialize
 	memset(hn->data, '\0', n);
 
     hn->key = word_dup(t);
+    hn->hash = h;
 
     hn->next = wh->bin[idx];
     wh->bin[idx] = hn;
@@ -374,7 +410,19 @@ wordhash_insert (wordhash_t *wh, word_t *t, size_t n, void (*initializer)(void *
     if (wh->type == WH_CNTS)
 	v = wordhash_counts_insert (wh);
     else
-	v = wordhash_standard_insert (wh, t, n, initializer);
+	v = wordhash_standard_insert (wh, t, hash (t), n, initializer);
+    return v;
+}
+
+void *
+wordhash_insert_hashed (wordhash_t *wh, word_t *t, unsigned int h,
+			size_t n, void (*initializer)(void *))
+{
+    void *v;
+    if (wh->type == WH_CNTS)
+	v = wordhash_counts_insert (wh);
+    else
+	v = wordhash_standard_insert (wh, t, h, n, initializer);
     return v;
 }
 
@@ -472,6 +520,27 @@ wordhash_sort (wordhash_t *wh)
     return;
 }
 
+static int (*sort_cmp)(const word_t *, const word_t *);
+
+static int compare_hashnode_by(const void *const pv1, const void *const pv2)
+{
+    const hashnode_t *hn1 = (const hashnode_t *)pv1;
+    const hashnode_t *hn2 = (const hashnode_t *)pv2;
+    return sort_cmp(hn1->key, hn2->key);
+}
+
+/* wordhash_sort_by - sort by ascending token, in the order of cmp */
+
+void
+wordhash_sort_by (wordhash_t *wh, int (*cmp)(const word_t *, const word_t *))
+{
+    sort_cmp = cmp;
+    wh->iter_head = (hashnode_t *)listsort((element *)wh->iter_head, (fcn_compare *)&compare_hashnode_by);
+    sort_cmp = NULL;
+
+    return;
+}
+
 /* 
 ** convert_propslist_to_countlist() allocates a new wordhash_t struct
 ** to improve program locality and lessen need for swapping when
@@ -528,7 +597,7 @@ convert_wordhash_to_propslist(wordhash_t *whi, wordhash_t *db)
 	    wordprop_t *wp;
 	    if (!msg_count_file && node->key != NULL) {
 		who->freeable = false;
-		wp = (wordprop_t *)wordhash_insert(db, node->key, sizeof(wordprop_t), NULL);
+		wp = (wordprop_t *)wordhash_insert_hashed(db, node->key, node->hash, sizeof(wordprop_t), NULL);
 	    }
 	    else {
 		wp = (wordprop_t *)xcalloc(1, sizeof(wordprop_t));
@@ -9,6 +9,7 @@ typedef struct hashnode_t {
   struct hashnode_t *next;			/* Next item in linked list of items with same hash */ 
   word_t *key;					/* word key */
   void   *data;					/* Associated data. To be used by caller. */
+  unsigned int hash;				/* wordhash_hash() of key */
 } hashnode_t;
 
 typedef struct wh_alloc_node {
@@ -56,16 +57,27 @@ typedef struct wordhash_s {
 void wordhash_free(/*@only@*/ wordhash_t *);
 size_t wordhash_count(wordhash_t * h);
 void wordhash_sort(wordhash_t * h);
+void wordhash_sort_by(wordhash_t * h, int (*cmp)(const word_t *, const word_t *));
 void wordhash_add(wordhash_t *dst, wordhash_t *src, void (*initializer)(void *));
 void wordhash_set_counts(wordhash_t *wh, int good, int bad);
 
 void *wordhash_search (const wordhash_t *wh, const word_t *t, uint hash);
+void *wordhash_search_hashed (const wordhash_t *wh, const word_t *t, unsigned int h);
 
 /* Given h, s, n, search for key s.
  * If found, return pointer to associated buffer.
  * Else, insert key and return pointer to allocated buffer of size n. */
 /*@observer@*/ void *wordhash_insert(wordhash_t *, word_t *, size_t, void (*)(void *));
 
+/* As wordhash_insert, with the key's wordhash_hash() already known. */
+/*@observer@*/ void *wordhash_insert_hashed(wordhash_t *, word_t *, unsigned int, size_t, void (*)(void *));
+
+/* The hash of the key text continued from h: h*MULT^leng + hash(text).
+ * wordhash_hash_pow(n) is MULT^n, so the hash of a key's tail can be
+ * found from running hashes of its prefixes. */
+unsigned int wordhash_hash(unsigned int h, const byte *text, uint leng);
+unsigned int wordhash_hash_pow(uint n);
+
 /* Starts an iteration over the hash entries */
 /*@null@*/ /*@exposed@*/ void *wordhash_first(wordhash_t *);
 
@@ -8,6 +8,7 @@
 
 #include "bogofilter.h"
 #include "datastore.h"
+#include "journal.h"
 #include "msgcounts.h"
 #include "mxcat.h"
 #include "paths.h"
@@ -68,7 +69,7 @@ void begin_wordlist(wordlist_t *list)
 
     while (1) {
 	if (ds_txn_begin(list->dsh)) {
-	    rand_sleep(1000,1000000);
+	    lock_sleep(1000,1000000);
 	    continue;
 	}
 	switch (ds_get_msgcounts(list->dsh, &val)) {
@@ -92,6 +93,8 @@ void begin_wordlist(wordlist_t *list)
 	    case DS_ABORT_RETRY:
 		continue;
 	}
+	if (journal_load(list) == DS_ABORT_RETRY)
+	    continue;
 	break;
     }
 }
@@ -126,7 +129,7 @@ static bool open_wordlist(wordlist_t *list, dbmode_t mode)
 #ifdef __EMX__
 	case EACCES:
 #endif
-	    rand_sleep(MIN_SLEEP, MAX_SLEEP);
+	    lock_sleep(MIN_SLEEP, MAX_SLEEP);
 	    retry = true;
 	    break;
 	default:
@@ -246,6 +249,10 @@ bool close_wordlists(bool commit /** if unset, abort */)
     for (list = word_lists; list != NULL ; list = list->next) {
 	void *vhandle = list->dsh;
 	list->dsh = NULL;
+	if (list->ignored) {
+	    wordhash_free(list->ignored);
+	    list->ignored = NULL;
+	}
 	if (vhandle) {
 	    if (commit) {
 		if (ds_txn_commit(vhandle))
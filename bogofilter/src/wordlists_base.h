@@ -8,6 +8,7 @@ typedef void *dsh_t;
 #endif
 
 #include "paths.h"
+#include "wordhash.h"
 
 typedef enum e_WL_TYPE {
     WL_REGULAR =	'R',	/**< list contains regular tokens */
@@ -27,6 +28,7 @@ struct wordlist_s
     WL_TYPE	type;			/**< datastore type */
     int		override;		/**< priority in queue */
     e_enc	encoding;		/**< encoding */
+    /*@null@*/ wordhash_t *ignored;	/**< tokens of an ignore list, read at its first lookup */
 };
 
 void wordlists_set_bogohome(void);